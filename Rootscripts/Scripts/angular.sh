@@ -5,6 +5,8 @@
 declare rfile
 declare rscript=.
 declare dfile
+declare windows=
+declare calib=
 
 #angles=(0,5,10,15,20,30,-5,-10,-15,0,-20)
 #duration=(10,10,10,10,10,10,10,10,10,5,5);
@@ -19,6 +21,10 @@ while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
 		shift; rfile=$1 ;;
 		-R | --rootscript )
 		shift; rscript=$1 ;;
+		-w | --windows )
+		shift; windows=$1 ;;
+		-c | --calib )
+		shift; calib=$1 ;;
 esac; shift; done
 if [[ "$1" == '--' ]]; then shift; fi
 
@@ -44,5 +50,11 @@ allfile=\"${allfile}\"
 allduration=\"${allduration}\"
 rfile=\"${rfile}\"
 
-root "${rscript}/angular_study.C(${allfile}, ${allangle}, ${allduration}, ${rfile})"
+# -w "g11:126:168,g11:120:175,..." sweeps the windows with angular_scan
+# -c energy_calib.root takes the windows in keV ("g11:435:590,...")
+if [[ -n "${windows}" || -n "${calib}" ]]; then
+	root -l -e ".L ${rscript}/angular_study.C+" -e "angular_scan(${allfile}, ${allangle}, ${allduration}, \"${windows}\", ${rfile}, 256, \"${calib}\")"
+else
+	root "${rscript}/angular_study.C(${allfile}, ${allangle}, ${allduration}, ${rfile})"
+fi
 
@@ -8,6 +8,9 @@ prefix=tag
 suffix=.root
 choice=
 rfile=./default.root
+nboot=0
+seed=1
+calib=
 
 
 while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
@@ -15,6 +18,12 @@ while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
 		shift; choice=$1 ;;
 		-r | --rootfile )
 		shift; rfile=$1 ;;
+		-b | --bootstrap )
+		shift; nboot=$1 ;;
+		-s | --seed )
+		shift; seed=$1 ;;
+		-c | --calib )
+		shift; calib=$1 ;;
 esac; shift; done
 if [[ "$1" == '--' ]]; then shift; fi
 if [[ $choice -eq 0 ]]; then
@@ -42,4 +51,5 @@ pdata=\"${pdata}\"
 rfile=\"${rfile}\"
 bkgFull=\"../Rootfiles/background/tag027X${suffix}\"
 
-root "${rscript}/attenuation.C(${files}, ${pdata}, ${bkgFull}, ${rfile}, ${choice})"
+# -c ../Rootfiles/energy_calibration/energy_calib.root takes the peak windows in keV
+root "${rscript}/attenuation.C(${files}, ${pdata}, ${bkgFull}, ${rfile}, ${choice}, false, 5.0, 10.0, ${nboot}, ${seed}, 0, \"${calib}\")"
@@ -0,0 +1,63 @@
+#! /bin/bash
+# example
+# ./Scripts/bench.sh -n "1000 10000 100000 1000000" -o ../bench.csv
+# ./Scripts/bench.sh -n 10000 --no-prof          # instrumentation compiled out
+# ./Scripts/bench.sh --data ../data -o ../bench.csv  # convert the real data set
+# Every run is appended to the report (.jsonl, one JSON object per line, or .csv)
+
+declare rscript=.
+declare sizes=1000
+declare sreport=bench.csv
+declare sout=
+declare nchan=1024
+declare nthreads=0
+declare seed=1
+declare scale=1.0
+declare dfile=
+declare incpath=
+declare noprof=false
+
+while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
+		-n | --nspectra )
+		shift; sizes=$1 ;;
+		-o | --report )
+		shift; sreport=$1 ;;
+		-f | --fits )
+		shift; sout=$1 ;;
+		-c | --nchan )
+		shift; nchan=$1 ;;
+		-j | --threads )
+		shift; nthreads=$1 ;;
+		-s | --seed )
+		shift; seed=$1 ;;
+		--scale )
+		shift; scale=$1 ;;
+		-d | --data )
+		shift; dfile=$1 ;;
+		-R | --rootscript )
+		shift; rscript=$1 ;;
+		--no-prof )
+		noprof=true ;;
+esac; shift; done
+if [[ "$1" == '--' ]]; then shift; fi
+
+# ACLiC does not rebuild when only the flags change, so the build without
+# instrumentation gets its own build directory and never shares a library
+# with the instrumented one
+if [[ "${noprof}" == true ]]; then
+	builddir=${rscript}/.aclic_noprof
+	mkdir -p "${builddir}"
+	incpath="gSystem->AddIncludePath(\"-DGSPEC_NO_PROF\"); gSystem->SetBuildDir(\"${builddir}\", true);"
+fi
+
+if [[ -n "${dfile}" ]]; then
+	# Convert every tag group of the data set, ignoring up to date outputs
+	tmpdir=$(mktemp -d)
+	GSPEC_PROF=${sreport} root -l -b -q -e "${incpath}" "${rscript}/batch_convert.C+(\"${dfile}\", \"${tmpdir}\", ${nthreads}, true)"
+	rm -rf "${tmpdir}"
+	exit
+fi
+
+for n in ${sizes}; do
+	root -l -b -q -e "${incpath}" "${rscript}/bench_throughput.C+(${n}, \"${sreport}\", \"${sout}\", ${nchan}, ${nthreads}, ${seed}, ${scale})"
+done
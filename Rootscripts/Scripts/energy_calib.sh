@@ -8,6 +8,17 @@ NA=('022X' '023X')
 NADUR=(5 5)
 CS=('025X' '026X')
 CSDUR=(5 5)
+nboot=0
+seed=1
+
+# -b N runs N Poisson bootstrap replicas of gain and offset
+while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
+		-b | --bootstrap )
+		shift; nboot=$1 ;;
+		-s | --seed )
+		shift; seed=$1 ;;
+esac; shift; done
+if [[ "$1" == '--' ]]; then shift; fi
 
 fileNa=
 for val in "${NA[@]}"; do
@@ -35,4 +46,4 @@ echo ${CsFull}
 echo ${bkgFull}
 echo ${savefile}
 
-root "${rscript}/energy_calibration.C(${NaFull},\"${NADURATION}\", ${CsFull}, \"${CSDURATION}\", ${bkgFull}, \"5\", ${savefile})"
+root "${rscript}/energy_calibration.C(${NaFull},\"${NADURATION}\", ${CsFull}, \"${CSDURATION}\", ${bkgFull}, \"5\", ${savefile}, false, ${nboot}, ${seed})"
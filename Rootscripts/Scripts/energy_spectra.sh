@@ -0,0 +1,36 @@
+#! /bin/bash
+# example
+# ./Scripts/energy_spectra.sh -d ../Rootfiles/angular -o ./angular_keV.root
+# ./Scripts/energy_spectra.sh -d ../Rootfiles/angular -o ./angular_keV.root -n g11,g12 -a 1024,0,2048
+# Every tag*X.root in the data directory is rebinned onto one keV axis
+# with the calibration written by energy_calib.sh
+
+declare dfile
+declare sout=./energy_spectra.root
+declare rscript=.
+declare calib=../Rootfiles/energy_calibration/energy_calib.root
+declare hnames=gam1,gam2
+declare axis=1500,0,1500
+
+while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
+		-d | --data )
+		shift; dfile=$1 ;;
+		-o | --output )
+		shift; sout=$1 ;;
+		-R | --rootscript )
+		shift; rscript=$1 ;;
+		-c | --calib )
+		shift; calib=$1 ;;
+		-n | --names )
+		shift; hnames=$1 ;;
+		-a | --axis )
+		shift; axis=$1 ;;
+esac; shift; done
+if [[ "$1" == '--' ]]; then shift; fi
+
+allfile=
+for file in ${dfile}/tag*X.root; do
+	allfile=${allfile}${file}'\n'
+done
+
+root -l -b -q "${rscript}/energy_spectra.C+(\"${allfile}\", \"${calib}\", \"${sout}\", \"${hnames}\", ${axis})"
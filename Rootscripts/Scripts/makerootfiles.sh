@@ -11,6 +11,8 @@ rundescr=('energy_calibration' 'angular' 'background' 'Scope' 'HW_coincidence')
 declare rfile
 declare rscript=.
 declare dfile
+declare nthreads=0
+declare force=false
 
 while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
 		-d | --data )
@@ -19,17 +21,14 @@ while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
 		shift; rfile=$1 ;;
 		-R | --rootscript )
 		shift; rscript=$1 ;;
+		-j | --threads )
+		shift; nthreads=$1 ;;
+		-f | --force )
+		force=true ;;
 esac; shift; done
 if [[ "$1" == '--' ]]; then shift; fi
 
 
-for file in ${dfile}/tag*0.xy; do
-	path=\"${file%/tag*}\"
-	TAG=${file#*tag}
-	TAG=${TAG%.*}
-	savefile=\"${rfile}/"tag"${TAG%?}"X.root"\"
-	TAG=\"${TAG}\"
-	root -q "${rscript}/make_rootfiles.C(${path}, ${TAG}, ${savefile})"
-done
-
-
+# Converts every tag group below ${dfile} on a thread pool,
+# skipping groups whose tagNNNX.root is already up to date
+root -l -b -q "${rscript}/batch_convert.C+(\"${dfile}\", \"${rfile}\", ${nthreads}, ${force})"
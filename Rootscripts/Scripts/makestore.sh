@@ -0,0 +1,25 @@
+#! /bin/bash
+# example
+# ./Scripts/makestore.sh -d ../data -o ../Rootfiles/run.gss
+# ./Scripts/makestore.sh -d ../Rootfiles -o ../Rootfiles/run.gss --from-root
+# The analysis macros then take "../Rootfiles/run.gss:040" in place of
+# "../Rootfiles/angular/tag040X.root"
+
+declare dfile
+declare sout
+declare rscript=.
+declare useroot=false
+
+while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
+		-d | --data )
+		shift; dfile=$1 ;;
+		-o | --output )
+		shift; sout=$1 ;;
+		-R | --rootscript )
+		shift; rscript=$1 ;;
+		--from-root )
+		useroot=true ;;
+esac; shift; done
+if [[ "$1" == '--' ]]; then shift; fi
+
+root -l -b -q "${rscript}/make_spectrum_store.C+(\"${dfile}\", \"${sout}\", ${useroot})"
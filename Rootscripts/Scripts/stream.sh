@@ -0,0 +1,54 @@
+#! /bin/bash
+# example
+# ./Scripts/stream.sh -d /path/mca/output -l 500 -o ./live.csv
+# ./Scripts/stream.sh -d /tmp/live -w "g11:126:168,g12:283:376" -t 60
+# Replay recorded data into a directory to test it:
+# ./Scripts/stream.sh --replay ../data/angular -d /tmp/live -n 20 -i 0.5
+# (--rewrite dumps whole files through a rename, --rewrite-inplace truncates
+# and rewrites them, as some MCAs do)
+
+declare dfile
+declare rscript=.
+declare windows=
+declare latency=500
+declare runtime=0
+declare sout=
+declare inotify=true
+declare replay=
+declare nslices=20
+declare interval=0.5
+declare rewrite=0
+
+while [[ "$1" =~ ^- && ! "$1" == "--" ]]; do case $1 in
+		-d | --data )
+		shift; dfile=$1 ;;
+		-R | --rootscript )
+		shift; rscript=$1 ;;
+		-w | --windows )
+		shift; windows=$1 ;;
+		-l | --latency )
+		shift; latency=$1 ;;
+		-t | --time )
+		shift; runtime=$1 ;;
+		-o | --output )
+		shift; sout=$1 ;;
+		--poll )
+		inotify=false ;;
+		--replay )
+		shift; replay=$1 ;;
+		-n | --slices )
+		shift; nslices=$1 ;;
+		-i | --interval )
+		shift; interval=$1 ;;
+		--rewrite )
+		rewrite=1 ;;
+		--rewrite-inplace )
+		rewrite=2 ;;
+esac; shift; done
+if [[ "$1" == '--' ]]; then shift; fi
+
+if [[ -n "${replay}" ]]; then
+	root -l -b -q "${rscript}/xy_replay.C+(\"${replay}\", \"${dfile}\", ${nslices}, ${interval}, ${rewrite})"
+else
+	root -l -b -q "${rscript}/stream_analysis.C+(\"${dfile}\", \"${windows}\", ${latency}, ${runtime}, \"${sout}\", ${inotify})"
+fi
@@ -40,7 +40,7 @@ public:
 	GPHYS_Quantity operator/(const GPHYS_Quantity&) const;
 	GPHYS_Quantity operator+(const GPHYS_Quantity&) const;
 	GPHYS_Quantity operator-(const GPHYS_Quantity&) const;
-	GPHYS_Quantity operator=(const GPHYS_Quantity&);
+	GPHYS_Quantity& operator=(const GPHYS_Quantity&);
 	bool operator==(const GPHYS_Quantity&) const;
 	bool operator!=(const GPHYS_Quantity&) const;
 
@@ -115,7 +115,7 @@ GPHYS_Quantity GPHYS_Quantity::operator-(const GPHYS_Quantity& other) const
 {
 	return 	_propogate_addition_error(_quantity, _error, other._quantity, other._error, 0, -1);
 }
-GPHYS_Quantity GPHYS_Quantity::operator=(const GPHYS_Quantity& other)
+GPHYS_Quantity& GPHYS_Quantity::operator=(const GPHYS_Quantity& other)
 {
 	// Check for self assignment
 	if (this != &other) {
@@ -252,10 +252,11 @@ void GPHYS_Quantity::sub(const GPHYS_Quantity& other, const double cov)
  */
 void GPHYS_Quantity::log(const GPHYS_Quantity& other)
 {
-	GPHYS_Quantity tmp;
-	tmp = other;
-	_quantity = std::log(tmp._quantity);
-	_error    = tmp._error / _quantity;
+	// other may be *this
+	double A  = other._quantity;
+	double SA = other._error;
+	_quantity = std::log(A);
+	_error    = SA / A;
 }
 /* Error Propogation w/o Covariance*/
 ////////////////////////////////////////////////
@@ -0,0 +1,415 @@
+#ifndef GPHYS_QUANTITYARRAY_H
+#define GPHYS_QUANTITYARRAY_H
+/***
+ * File: GPHYS_QuantityArray.h
+ *
+ * Discription:
+ *	Batch companion of GPHYS_Quantity. Values and errors of N
+ *	quantities (e.g. the bins of a spectrum) are kept in two separate,
+ *	64 byte aligned arrays, and the operators propagate the errors
+ *	element by element.
+ *
+ *	The operators build expression templates, so
+ *		GPHYS_QuantityArray d = a0 + a1 + a2 + a3;
+ *	runs one loop over the elements and creates no temporary arrays.
+ *	Inside an expression the variances are carried (no sqrt between
+ *	steps); the sqrt is taken once when the result is stored. The
+ *	loops are plain contiguous loops the compiler can vectorise.
+ *
+ *	GPHYS_Constant is a constexpr value +- error (e.g. a tabulated
+ *	attenuation coefficient) that can be used on either side of an
+ *	array expression.
+ *
+ *	Arrays in one expression must have the same size (constants
+ *	broadcast); a mismatch throws std::length_error when the
+ *	expression is evaluated.
+ *
+ *	If there are covariances between two arrays the mult(...), div(...),
+ *	add(...) and sub(...) functions take an array of per element
+ *	covariances, like the GPHYS_Quantity versions.
+ *
+ * Operations implemented (w/ error prop.) : expression template ?
+ * Addition/ Subtraction 	 : Y
+ * Multiplication / Division : Y
+ * Scaling by a constant     : Y
+ * Logorithm                 : Y
+ **/
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "GPHYS_Quantity.h"
+
+////////////////////////////////////////////////
+/* Compile time constants */
+
+class GPHYS_Constant
+{
+public:
+	constexpr GPHYS_Constant(double q = 0, double e = 0) : _quantity(q), _variance(e*e) { }
+
+	constexpr double getQuantity() const { return _quantity; }
+	constexpr double getVariance() const { return _variance; }
+	double getError() const { return std::sqrt(_variance); }
+
+	// Error propagation (independent quantities)
+	constexpr GPHYS_Constant operator+(const GPHYS_Constant& o) const { return _make(_quantity + o._quantity, _variance + o._variance); }
+	constexpr GPHYS_Constant operator-(const GPHYS_Constant& o) const { return _make(_quantity - o._quantity, _variance + o._variance); }
+	constexpr GPHYS_Constant operator*(const GPHYS_Constant& o) const
+	{
+		return _make(_quantity * o._quantity, o._quantity*o._quantity*_variance + _quantity*_quantity*o._variance);
+	}
+	constexpr GPHYS_Constant operator/(const GPHYS_Constant& o) const
+	{
+		return _make(_quantity / o._quantity, (_variance + (_quantity/o._quantity)*(_quantity/o._quantity)*o._variance) / (o._quantity*o._quantity));
+	}
+
+	operator GPHYS_Quantity() const { return GPHYS_Quantity(_quantity, getError()); }
+
+	// Expression interface (a constant broadcasts to every element)
+	double value(size_t) const    { return _quantity; }
+	double variance(size_t) const { return _variance; }
+	size_t size() const { return 0; }
+
+private:
+	static constexpr GPHYS_Constant _make(double q, double var)
+	{
+		GPHYS_Constant c(q, 0);
+		c._variance = var;
+		return c;
+	}
+	double _quantity;
+	double _variance;
+};
+
+/* Compile time constants */
+////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////
+/* Expression templates */
+
+// Every expression node derives from GQExpr<itself>
+template<class E> struct GQExpr
+{
+	const E& self() const { return static_cast<const E&>(*this); }
+};
+
+// Arrays are held by reference, everything else (small nodes and
+// constants) by value so temporaries in an expression stay alive
+class GPHYS_QuantityArray;
+template<class T> struct _gq_ref { typedef T type; };
+template<> struct _gq_ref<GPHYS_QuantityArray> { typedef const GPHYS_QuantityArray& type; };
+
+// Size of a binary node; constants (size 0) broadcast, arrays must agree
+template<class L, class R>
+static inline size_t _gq_size(const L& l, const R& r)
+{
+	size_t nl = l.size(), nr = r.size();
+	if( nl && nr && nl != nr )
+		throw std::length_error("GPHYS_QuantityArray: size mismatch (" + std::to_string(nl) + " vs " + std::to_string(nr) + ")");
+	return nl ? nl : nr;
+}
+
+template<class L, class R> struct GQAdd : GQExpr< GQAdd<L,R> >
+{
+	typename _gq_ref<L>::type l; typename _gq_ref<R>::type r;
+	GQAdd(const L& a, const R& b) : l(a), r(b) { }
+	double value(size_t i) const    { return l.value(i) + r.value(i); }
+	double variance(size_t i) const { return l.variance(i) + r.variance(i); }
+	size_t size() const { return _gq_size(l, r); }
+};
+
+template<class L, class R> struct GQSub : GQExpr< GQSub<L,R> >
+{
+	typename _gq_ref<L>::type l; typename _gq_ref<R>::type r;
+	GQSub(const L& a, const R& b) : l(a), r(b) { }
+	double value(size_t i) const    { return l.value(i) - r.value(i); }
+	double variance(size_t i) const { return l.variance(i) + r.variance(i); }
+	size_t size() const { return _gq_size(l, r); }
+};
+
+// var(AB) = B^2 var(A) + A^2 var(B), same as F^2 [ (sA/A)^2 + (sB/B)^2 ]
+// but finite when A or B is 0
+template<class L, class R> struct GQMul : GQExpr< GQMul<L,R> >
+{
+	typename _gq_ref<L>::type l; typename _gq_ref<R>::type r;
+	GQMul(const L& a, const R& b) : l(a), r(b) { }
+	double value(size_t i) const    { return l.value(i) * r.value(i); }
+	double variance(size_t i) const
+	{
+		double a = l.value(i), b = r.value(i);
+		return b*b*l.variance(i) + a*a*r.variance(i);
+	}
+	size_t size() const { return _gq_size(l, r); }
+};
+
+// var(A/B) = ( var(A) + (A/B)^2 var(B) ) / B^2
+template<class L, class R> struct GQDiv : GQExpr< GQDiv<L,R> >
+{
+	typename _gq_ref<L>::type l; typename _gq_ref<R>::type r;
+	GQDiv(const L& a, const R& b) : l(a), r(b) { }
+	double value(size_t i) const    { return l.value(i) / r.value(i); }
+	double variance(size_t i) const
+	{
+		double b = r.value(i), f = l.value(i) / b;
+		return ( l.variance(i) + f*f*r.variance(i) ) / (b*b);
+	}
+	size_t size() const { return _gq_size(l, r); }
+};
+
+// Exact scaling by a number (no error on s)
+template<class E> struct GQScale : GQExpr< GQScale<E> >
+{
+	typename _gq_ref<E>::type e; double s;
+	GQScale(const E& a, double b) : e(a), s(b) { }
+	double value(size_t i) const    { return s * e.value(i); }
+	double variance(size_t i) const { return s*s * e.variance(i); }
+	size_t size() const { return e.size(); }
+};
+
+// var(ln A) = var(A) / A^2
+template<class E> struct GQLog : GQExpr< GQLog<E> >
+{
+	typename _gq_ref<E>::type e;
+	GQLog(const E& a) : e(a) { }
+	double value(size_t i) const    { return std::log( e.value(i) ); }
+	double variance(size_t i) const { double a = e.value(i); return e.variance(i) / (a*a); }
+	size_t size() const { return e.size(); }
+};
+
+/* Expression templates */
+////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////
+/* Aligned storage */
+
+template<class T, size_t Align = 64> struct GQAlignedAllocator
+{
+	typedef T value_type;
+	template<class U> struct rebind { typedef GQAlignedAllocator<U, Align> other; };
+	GQAlignedAllocator() { }
+	template<class U> GQAlignedAllocator(const GQAlignedAllocator<U, Align>&) { }
+	T* allocate(size_t n)
+	{
+		size_t bytes = ( (n*sizeof(T) + Align - 1) / Align ) * Align;
+		void* p = std::aligned_alloc(Align, bytes ? bytes : Align);
+		if(p == NULL) throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t) { std::free(p); }
+	template<class U> bool operator==(const GQAlignedAllocator<U, Align>&) const { return true; }
+	template<class U> bool operator!=(const GQAlignedAllocator<U, Align>&) const { return false; }
+};
+
+/* Aligned storage */
+////////////////////////////////////////////////
+
+
+class GPHYS_QuantityArray : public GQExpr<GPHYS_QuantityArray>
+{
+public:
+	typedef std::vector<double, GQAlignedAllocator<double> > array_t;
+
+	// Constructor
+	GPHYS_QuantityArray() { }
+	GPHYS_QuantityArray(size_t n, double q = 0, double e = 0) : _quantity(n, q), _error(n, e) { }
+	GPHYS_QuantityArray(const double* q, const double* e, size_t n);
+	template<class E> GPHYS_QuantityArray(const GQExpr<E>& expr) { _assign(expr.self()); }
+
+	// Values with variances (e.g. TH1 contents and Sumw2); NULL var means counts (var = q)
+	template<class T> static GPHYS_QuantityArray fromVariance(const T* q, const double* var, size_t n);
+
+public:
+	// Operator overloading
+	template<class E> GPHYS_QuantityArray& operator=(const GQExpr<E>& expr) { _assign(expr.self()); return *this; }
+	GPHYS_QuantityArray& operator*=(double s);
+	GPHYS_QuantityArray& operator/=(double s);
+
+public:
+	// Error Propogration with covariance (cov[i] = cov(this[i], other[i]))
+	void mult(const GPHYS_QuantityArray&, const double* cov);
+	void div(const GPHYS_QuantityArray&, const double* cov);
+	void add(const GPHYS_QuantityArray&, const double* cov);
+	void sub(const GPHYS_QuantityArray&, const double* cov);
+
+public:
+	size_t size() const { return _quantity.size(); }
+	void resize(size_t n) { _quantity.resize(n); _error.resize(n); }
+	void set(size_t i, double q, double e) { _quantity[i] = q; _error[i] = e; }
+	GPHYS_Quantity operator[](size_t i) const { return GPHYS_Quantity(_quantity[i], _error[i]); }
+	double getQuantity(size_t i) const { return _quantity[i]; }
+	double getError(size_t i) const    { return _error[i]; }
+	const double* quantities() const { return _quantity.data(); }
+	const double* errors() const     { return _error.data(); }
+	double* quantities() { return _quantity.data(); }
+	double* errors()     { return _error.data(); }
+
+	// Expression interface
+	double value(size_t i) const    { return _quantity[i]; }
+	double variance(size_t i) const { return _error[i]*_error[i]; }
+
+private:
+	template<class E> void _assign(const E& expr);
+
+private:
+	array_t _quantity;
+	array_t _error;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+GPHYS_QuantityArray::GPHYS_QuantityArray(const double* q, const double* e, size_t n) : _quantity(q, q+n), _error(n, 0)
+{
+	if(e) for(size_t i = 0; i < n; i++) _error[i] = e[i];
+}
+
+template<class T>
+GPHYS_QuantityArray GPHYS_QuantityArray::fromVariance(const T* q, const double* var, size_t n)
+{
+	GPHYS_QuantityArray a(n);
+	double* aq = a._quantity.data();
+	double* ae = a._error.data();
+	for(size_t i = 0; i < n; i++) {
+		aq[i] = q[i];
+		ae[i] = std::sqrt( var ? var[i] : (double)q[i] );
+	}
+	return a;
+}
+
+/*
+ * Func: _assign
+ * Brief:
+ *	Evaluates an expression element by element. The result is first
+ *	written to fresh storage so expressions that read *this
+ *	(a = a + b) are safe.
+ */
+template<class E>
+void GPHYS_QuantityArray::_assign(const E& expr)
+{
+	size_t n = expr.size(); // checks every binary node of expr
+	array_t q(n), e(n);
+	double* __restrict pq = q.data();
+	double* __restrict pe = e.data();
+	for(size_t i = 0; i < n; i++) {
+		pq[i] = expr.value(i);
+		pe[i] = std::sqrt( expr.variance(i) );
+	}
+	_quantity.swap(q);
+	_error.swap(e);
+}
+
+GPHYS_QuantityArray& GPHYS_QuantityArray::operator*=(double s)
+{
+	double as = std::fabs(s);
+	for(size_t i = 0; i < size(); i++) { _quantity[i] *= s; _error[i] *= as; }
+	return *this;
+}
+
+GPHYS_QuantityArray& GPHYS_QuantityArray::operator/=(double s)
+{
+	return (*this *= 1.0/s);
+}
+
+////////////////////////////////////////////////
+/* Operator Overloading */
+
+template<class L, class R> GQAdd<L,R> operator+(const GQExpr<L>& a, const GQExpr<R>& b) { return GQAdd<L,R>(a.self(), b.self()); }
+template<class L, class R> GQSub<L,R> operator-(const GQExpr<L>& a, const GQExpr<R>& b) { return GQSub<L,R>(a.self(), b.self()); }
+template<class L, class R> GQMul<L,R> operator*(const GQExpr<L>& a, const GQExpr<R>& b) { return GQMul<L,R>(a.self(), b.self()); }
+template<class L, class R> GQDiv<L,R> operator/(const GQExpr<L>& a, const GQExpr<R>& b) { return GQDiv<L,R>(a.self(), b.self()); }
+
+// With a constant (which has an error) on either side
+template<class E> GQAdd<E,GPHYS_Constant> operator+(const GQExpr<E>& a, const GPHYS_Constant& c) { return GQAdd<E,GPHYS_Constant>(a.self(), c); }
+template<class E> GQAdd<GPHYS_Constant,E> operator+(const GPHYS_Constant& c, const GQExpr<E>& a) { return GQAdd<GPHYS_Constant,E>(c, a.self()); }
+template<class E> GQSub<E,GPHYS_Constant> operator-(const GQExpr<E>& a, const GPHYS_Constant& c) { return GQSub<E,GPHYS_Constant>(a.self(), c); }
+template<class E> GQSub<GPHYS_Constant,E> operator-(const GPHYS_Constant& c, const GQExpr<E>& a) { return GQSub<GPHYS_Constant,E>(c, a.self()); }
+template<class E> GQMul<E,GPHYS_Constant> operator*(const GQExpr<E>& a, const GPHYS_Constant& c) { return GQMul<E,GPHYS_Constant>(a.self(), c); }
+template<class E> GQMul<GPHYS_Constant,E> operator*(const GPHYS_Constant& c, const GQExpr<E>& a) { return GQMul<GPHYS_Constant,E>(c, a.self()); }
+template<class E> GQDiv<E,GPHYS_Constant> operator/(const GQExpr<E>& a, const GPHYS_Constant& c) { return GQDiv<E,GPHYS_Constant>(a.self(), c); }
+template<class E> GQDiv<GPHYS_Constant,E> operator/(const GPHYS_Constant& c, const GQExpr<E>& a) { return GQDiv<GPHYS_Constant,E>(c, a.self()); }
+
+// Exact scaling
+template<class E> GQScale<E> operator*(const GQExpr<E>& a, double s) { return GQScale<E>(a.self(), s); }
+template<class E> GQScale<E> operator*(double s, const GQExpr<E>& a) { return GQScale<E>(a.self(), s); }
+template<class E> GQScale<E> operator/(const GQExpr<E>& a, double s) { return GQScale<E>(a.self(), 1.0/s); }
+
+template<class E> GQLog<E> log(const GQExpr<E>& a) { return GQLog<E>(a.self()); }
+
+std::ostream& operator<<(std::ostream &os, const GPHYS_QuantityArray& tmp)
+{
+	for(size_t i = 0; i < tmp.size(); i++)
+		os << tmp.getQuantity(i) << " +- " << tmp.getError(i) << "\n";
+	return os;
+}
+/* Operator Overloading */
+////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////
+/* Error Propogation w/ Covariance*/
+/*
+ * Same formulas as GPHYS_Quantity::_propogate_multiplication_error and
+ * _propogate_addition_error, one element at a time:
+ *	F = A*B OR F = A/B : sF^2 = F^2 * { ( sA / A )^2 + ( sB / B )^2 +- 2 * cov(A,B) / (A*B) }
+ *	F = A+-B           : sF^2 = sA^2 + sB^2 +- 2 * cov(A,B)
+ * other must have the size of this array.
+ */
+static inline void _gq_check_size(size_t n, size_t m)
+{
+	if( n != m )
+		throw std::length_error("GPHYS_QuantityArray: size mismatch (" + std::to_string(n) + " vs " + std::to_string(m) + ")");
+}
+
+void GPHYS_QuantityArray::mult(const GPHYS_QuantityArray& other, const double* cov)
+{
+	_gq_check_size(size(), other.size());
+	for(size_t i = 0; i < size(); i++) {
+		double A = _quantity[i], B = other._quantity[i];
+		double F = A*B;
+		double e_sq = B*B*_error[i]*_error[i] + A*A*other._error[i]*other._error[i] + (cov ? 2*F*cov[i] : 0);
+		_quantity[i] = F;
+		_error[i]    = std::sqrt(e_sq);
+	}
+}
+void GPHYS_QuantityArray::div(const GPHYS_QuantityArray& other, const double* cov)
+{
+	_gq_check_size(size(), other.size());
+	for(size_t i = 0; i < size(); i++) {
+		double A = _quantity[i], B = other._quantity[i];
+		double F = A/B;
+		double e_sq = ( _error[i]*_error[i] + F*F*other._error[i]*other._error[i] - (cov ? 2*F*cov[i] : 0) ) / (B*B);
+		_quantity[i] = F;
+		_error[i]    = std::sqrt(e_sq);
+	}
+}
+void GPHYS_QuantityArray::add(const GPHYS_QuantityArray& other, const double* cov)
+{
+	_gq_check_size(size(), other.size());
+	for(size_t i = 0; i < size(); i++) {
+		double e_sq = _error[i]*_error[i] + other._error[i]*other._error[i] + (cov ? 2*cov[i] : 0);
+		_quantity[i] += other._quantity[i];
+		_error[i]     = std::sqrt(e_sq);
+	}
+}
+void GPHYS_QuantityArray::sub(const GPHYS_QuantityArray& other, const double* cov)
+{
+	_gq_check_size(size(), other.size());
+	for(size_t i = 0; i < size(); i++) {
+		double e_sq = _error[i]*_error[i] + other._error[i]*other._error[i] - (cov ? 2*cov[i] : 0);
+		_quantity[i] -= other._quantity[i];
+		_error[i]     = std::sqrt(e_sq);
+	}
+}
+/* Error Propogation w/ Covariance*/
+////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+/***
+ * File: bootstrap.h
+ *
+ * Discription:
+ *	Parametric bootstrap of the analysis chain. Every replica Poisson
+ *	resamples the raw spectra, reruns the peak extraction and the fit
+ *	downstream of it, and returns a few numbers (attenuation
+ *	coefficients, gain and offset, ...). run_bootstrap(...) spreads the
+ *	replicas over a WorkPool and summarises the empirical distribution
+ *	of every number.
+ *
+ *	Random numbers come from Philox4x32-10, a counter based generator:
+ *	replica r draws from the stream keyed by (seed, r), so the result
+ *	does not depend on which thread ran the replica or on how many
+ *	threads there are.
+ *
+ *	Also here: the two small fits the macros do downstream of the peak
+ *	extraction, a straight line and an exponential, with x errors
+ *	handled like ROOT does for a TGraphErrors (effective variance).
+ *
+ *	Nothing in here depends on ROOT.
+ **/
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <functional>
+
+#include "workpool.h"
+
+/*
+ * Class: BootRng
+ * Brief:
+ *	Philox4x32-10 stream for one replica. Every block of four 32 bit
+ *	outputs is the encryption of the counter (block, replica) with the
+ *	key seed, so streams are independent and can be regenerated.
+ */
+class BootRng
+{
+public:
+	BootRng(uint64_t seed, uint64_t replica) : _k0((uint32_t)seed), _k1((uint32_t)(seed >> 32)),
+	                                          _rep(replica), _block(0), _next(4) { }
+
+	uint32_t next32()
+	{
+		if(_next == 4) { _generate(); _next = 0; }
+		return _out[_next++];
+	}
+
+	// Uniform in the open interval (0, 1), 53 bits
+	double uniform()
+	{
+		uint64_t hi = next32();
+		uint64_t u  = (hi << 21) ^ (next32() >> 11);
+		return ((double)u + 0.5) * (1.0 / 9007199254740992.0);
+	}
+
+	int poisson(double mean);
+
+private:
+	void _generate()
+	{
+		uint32_t c[4] = { (uint32_t)_block, (uint32_t)(_block >> 32), (uint32_t)_rep, (uint32_t)(_rep >> 32) };
+		uint32_t k0 = _k0, k1 = _k1;
+		for(int round = 0; round < 10; round++) {
+			uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+			uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+			uint32_t n0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+			uint32_t n2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+			c[0] = n0; c[1] = (uint32_t)p1; c[2] = n2; c[3] = (uint32_t)p0;
+			k0 += 0x9E3779B9u; k1 += 0xBB67AE85u;
+		}
+		for(int i = 0; i < 4; i++) _out[i] = c[i];
+		_block++;
+	}
+
+private:
+	uint32_t _k0, _k1;
+	uint64_t _rep;
+	uint64_t _block;
+	uint32_t _out[4];
+	int      _next;
+};
+
+/*
+ * Func: poisson
+ * Brief:
+ *	Poisson deviate of the given mean. Inversion below a mean of 10,
+ *	Hormann's transformed rejection (PTRS) above.
+ */
+int BootRng::poisson(double mean)
+{
+	if( !(mean > 0) ) return 0;
+	if( mean < 10 ) {
+		double p = std::exp(-mean), s = p, u = uniform();
+		int k = 0;
+		while( u > s && k < 1000 ) { k++; p *= mean/k; s += p; }
+		return k;
+	}
+	const double slam = std::sqrt(mean), loglam = std::log(mean);
+	const double b = 0.931 + 2.53*slam;
+	const double a = -0.059 + 0.02483*b;
+	const double invalpha = 1.1239 + 1.1328/(b - 3.4);
+	const double vr = 0.9277 - 3.6224/(b - 2);
+	while(true) {
+		double U  = uniform() - 0.5;
+		double V  = uniform();
+		double us = 0.5 - std::fabs(U);
+		double k  = std::floor( (2*a/us + b)*U + mean + 0.43 );
+		if( us >= 0.07 && V <= vr ) return (int)k;
+		if( k < 0 || (us < 0.013 && V > us) ) continue;
+		if( std::log(V) + std::log(invalpha) - std::log(a/(us*us) + b) <= -mean + k*loglam - std::lgamma(k + 1) )
+			return (int)k;
+	}
+}
+
+/*
+ * Func: poisson_resample
+ * Brief:
+ *	out[i] = Poisson(counts[i]) for i in [0, n): one replica of a raw
+ *	spectrum, with counts taken as the expected values.
+ */
+template<class T>
+static inline void poisson_resample(const T* counts, size_t n, double* out, BootRng& rng)
+{
+	for(size_t i = 0; i < n; i++) out[i] = rng.poisson( (double)counts[i] );
+}
+
+struct boot_summary_t
+{
+	std::string name;
+	size_t n      = 0;                 // replicas that succeeded
+	double mean   = 0, rms = 0;
+	double q025   = 0, q16 = 0, q50 = 0, q84 = 0, q975 = 0;
+};
+
+struct boot_result_t
+{
+	size_t nrep = 0, nobs = 0, nfailed = 0;
+	std::vector<double> values;        // values[r*nobs + k], NaN for failed replicas
+	std::vector<boot_summary_t> summary;
+	double seconds = 0;
+
+	const double* replica(size_t r) const { return values.data() + r*nobs; }
+};
+
+// Scratch space of one worker, reused across its replicas
+typedef std::vector<std::vector<double>> boot_scratch_t;
+
+// Computes the nobs observables of replica r into out; false if it failed
+typedef std::function<bool(size_t r, BootRng& rng, boot_scratch_t& scratch, double* out)> boot_replica_t;
+
+static inline double _boot_quantile(const std::vector<double>& sorted, double q)
+{
+	if( sorted.empty() ) return std::numeric_limits<double>::quiet_NaN();
+	double pos = q*(sorted.size() - 1);
+	size_t i = (size_t)pos;
+	if( i + 1 >= sorted.size() ) return sorted.back();
+	return sorted[i] + (pos - i)*(sorted[i+1] - sorted[i]);
+}
+
+/*
+ * Func: run_bootstrap
+ * Brief:
+ *	Runs nrep replicas of fn and summarises each of the observables
+ *	named in vnames. nthreads = 0 uses every core, 1 runs in the
+ *	calling thread.
+ * Comments:
+ *	Replicas are handed out in chunks and write into their own row of
+ *	values, so the summary only depends on (seed, nrep). A failed
+ *	replica (fn returns false or a non finite value) is left out.
+ */
+static inline boot_result_t run_bootstrap(size_t nrep, uint64_t seed, const std::vector<std::string>& vnames,
+                                          const boot_replica_t& fn, unsigned nthreads = 0)
+{
+	boot_result_t res;
+	res.nrep = nrep;
+	res.nobs = vnames.size();
+	res.values.assign(nrep*res.nobs, std::numeric_limits<double>::quiet_NaN());
+
+	auto t0 = std::chrono::steady_clock::now();
+	auto run_range = [&](size_t first, size_t last) {
+		boot_scratch_t scratch;
+		std::vector<double> out(res.nobs);
+		for(size_t r = first; r < last; r++) {
+			BootRng rng(seed, r);
+			bool ok = fn(r, rng, scratch, out.data());
+			for(size_t k = 0; k < res.nobs; k++) ok = ok && std::isfinite(out[k]);
+			if(ok) std::copy(out.begin(), out.end(), res.values.begin() + r*res.nobs);
+		}
+	};
+	if( nthreads == 1 || nrep < 2 ) run_range(0, nrep);
+	else {
+		WorkPool pool(nthreads);
+		size_t chunk = nrep / (8*pool.size()) + 1;
+		for(size_t first = 0; first < nrep; first += chunk)
+			pool.submit( [&, first]{ run_range(first, std::min(first + chunk, nrep)); } );
+		pool.wait();
+	}
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	std::vector<double> v;
+	for(size_t r = 0; r < nrep && res.nobs; r++) if( std::isnan(res.values[r*res.nobs]) ) res.nfailed++;
+	for(size_t k = 0; k < res.nobs; k++) {
+		boot_summary_t s;
+		s.name = vnames[k];
+		v.clear();
+		for(size_t r = 0; r < nrep; r++) {
+			double x = res.values[r*res.nobs + k];
+			if( !std::isnan(x) ) v.push_back(x);
+		}
+		s.n = v.size();
+		double sum = 0, sum2 = 0;
+		for(auto it = v.begin(); it != v.end(); it++) sum += *it;
+		if(s.n) s.mean = sum/s.n;
+		for(auto it = v.begin(); it != v.end(); it++) sum2 += (*it - s.mean)*(*it - s.mean);
+		if(s.n > 1) s.rms = std::sqrt( sum2/(s.n - 1) );
+		std::sort(v.begin(), v.end());
+		s.q025 = _boot_quantile(v, 0.025); s.q16 = _boot_quantile(v, 0.16); s.q50 = _boot_quantile(v, 0.5);
+		s.q84  = _boot_quantile(v, 0.84);  s.q975 = _boot_quantile(v, 0.975);
+		res.summary.push_back(s);
+	}
+	return res;
+}
+
+/*
+ * Func: print_bootstrap
+ * Brief:
+ *	One line per observable: median, 68% and 95% intervals and rms of
+ *	the replicas, next to the nominal value and error (e.g. from
+ *	Minuit) if given.
+ */
+static inline void print_bootstrap(const boot_result_t& res, const double* nominal = NULL, const double* nominal_err = NULL)
+{
+	std::printf("Bootstrap: %zu replicas (%zu failed) in %.2f s\t|\t%.0f replicas/s\n", res.nrep, res.nfailed,
+	            res.seconds, res.seconds > 0 ? res.nrep/res.seconds : 0.);
+	for(size_t k = 0; k < res.summary.size(); k++) {
+		const boot_summary_t& s = res.summary[k];
+		std::printf("  %-14s median %-12.6g 68%% [%.6g, %.6g]  95%% [%.6g, %.6g]  rms %.4g", s.name.c_str(),
+		            s.q50, s.q16, s.q84, s.q025, s.q975, s.rms);
+		if(nominal) std::printf("\t|\tfit %.6g +- %.4g", nominal[k], nominal_err ? nominal_err[k] : 0.);
+		std::printf("\n");
+	}
+}
+
+/*
+ * Func: fit_line
+ * Brief:
+ *	Chi2 fit of y = p[0] + p[1] x. With x errors the variance of a
+ *	point is ey^2 + (p[1] ex)^2 (ROOT's effective variance for a
+ *	TGraphErrors), iterated to convergence. ex may be NULL. Returns
+ *	chi2, or NaN if the fit is singular.
+ */
+static inline double fit_line(int n, const double* x, const double* y, const double* ex, const double* ey,
+                              double* p, double cov[2][2] = NULL)
+{
+	double b = 0, a = 0, chi2 = 0;
+	double det = 0, sw = 0, swx = 0, swxx = 0;
+	for(int iter = 0; iter < (ex ? 20 : 1); iter++) {
+		double swy = 0, swxy = 0;
+		sw = 0; swx = 0; swxx = 0;
+		for(int i = 0; i < n; i++) {
+			double v = ey[i]*ey[i] + (ex ? b*b*ex[i]*ex[i] : 0);
+			if( !(v > 0) ) continue;
+			double w = 1.0/v;
+			sw += w; swx += w*x[i]; swxx += w*x[i]*x[i]; swy += w*y[i]; swxy += w*x[i]*y[i];
+		}
+		det = sw*swxx - swx*swx;
+		if( !(det > 0) ) return std::numeric_limits<double>::quiet_NaN();
+		double bnew = (sw*swxy - swx*swy)/det;
+		a = (swxx*swy - swx*swxy)/det;
+		bool done = std::fabs(bnew - b) <= 1e-12*std::fabs(bnew);
+		b = bnew;
+		if(done) break;
+	}
+	p[0] = a; p[1] = b;
+	for(int i = 0; i < n; i++) {
+		double v = ey[i]*ey[i] + (ex ? b*b*ex[i]*ex[i] : 0);
+		if( !(v > 0) ) continue;
+		double r = y[i] - a - b*x[i];
+		chi2 += r*r/v;
+	}
+	if(cov) {
+		cov[0][0] = swxx/det; cov[1][1] = sw/det;
+		cov[0][1] = cov[1][0] = -swx/det;
+	}
+	return chi2;
+}
+
+/*
+ * Func: fit_expo
+ * Brief:
+ *	Chi2 fit of y = exp(p[0] + p[1] x) (ROOT's "expo"), with the same
+ *	effective variance treatment of ex as fit_line. Starts from a line
+ *	through log(y) and refines with Gauss-Newton. Returns chi2, or NaN
+ *	if no point has y > 0 or the fit is singular.
+ */
+static inline double fit_expo(int n, const double* x, const double* y, const double* ex, const double* ey,
+                              double* p, double cov[2][2] = NULL)
+{
+	std::vector<double> lx, ly, ley;
+	for(int i = 0; i < n; i++) {
+		if( !(y[i] > 0) || !(ey[i] > 0) ) continue;
+		lx.push_back(x[i]); ly.push_back(std::log(y[i])); ley.push_back(ey[i]/y[i]);
+	}
+	if( lx.size() < 2 ) return std::numeric_limits<double>::quiet_NaN();
+	if( std::isnan( fit_line((int)lx.size(), lx.data(), ly.data(), NULL, ley.data(), p) ) )
+		return std::numeric_limits<double>::quiet_NaN();
+
+	double chi2 = 0, jtj[3] = { 0, 0, 0 };
+	for(int iter = 0; iter < 50; iter++) {
+		double jtr[2] = { 0, 0 };
+		jtj[0] = jtj[1] = jtj[2] = 0;
+		chi2 = 0;
+		for(int i = 0; i < n; i++) {
+			double f = std::exp(p[0] + p[1]*x[i]);
+			double v = ey[i]*ey[i] + (ex ? p[1]*p[1]*f*f*ex[i]*ex[i] : 0);
+			if( !(v > 0) ) continue;
+			double w = 1.0/v, r = y[i] - f;
+			double g0 = f, g1 = f*x[i];
+			chi2   += w*r*r;
+			jtr[0] += w*g0*r;  jtr[1] += w*g1*r;
+			jtj[0] += w*g0*g0; jtj[1] += w*g0*g1; jtj[2] += w*g1*g1;
+		}
+		double det = jtj[0]*jtj[2] - jtj[1]*jtj[1];
+		if( !(det > 0) ) return std::numeric_limits<double>::quiet_NaN();
+		double d0 = ( jtj[2]*jtr[0] - jtj[1]*jtr[1])/det;
+		double d1 = (-jtj[1]*jtr[0] + jtj[0]*jtr[1])/det;
+		p[0] += d0; p[1] += d1;
+		if( std::fabs(d0) < 1e-10*(1 + std::fabs(p[0])) && std::fabs(d1) < 1e-10*(1 + std::fabs(p[1])) ) break;
+	}
+	if(cov) {
+		double det = jtj[0]*jtj[2] - jtj[1]*jtj[1];
+		cov[0][0] = jtj[2]/det; cov[1][1] = jtj[0]/det;
+		cov[0][1] = cov[1][0] = -jtj[1]/det;
+	}
+	return chi2;
+}
+
+#endif
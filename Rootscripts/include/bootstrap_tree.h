@@ -0,0 +1,38 @@
+#ifndef BOOTSTRAP_TREE_H
+#define BOOTSTRAP_TREE_H
+/***
+ * File: bootstrap_tree.h
+ *
+ * Discription:
+ *	Stores the replicas of a bootstrap (bootstrap.h) in a TTree, one
+ *	branch per observable and one entry per successful replica, so the
+ *	distributions can be drawn straight from the output file.
+ **/
+#include <vector>
+
+#include "TTree.h"
+
+#include "bootstrap.h"
+
+// Writes tree "name" (with title "title") into the current directory
+static inline TTree* write_bootstrap_tree(const boot_result_t& res, const char* name = "Bootstrap", const char* title = "Bootstrap replicas")
+{
+	TTree* t = new TTree(name, title);
+	std::vector<double> row(res.nobs);
+	Long64_t replica;
+	t->Branch("replica", &replica, "replica/L");
+	for(size_t k = 0; k < res.nobs; k++)
+		t->Branch(res.summary[k].name.c_str(), &row[k], (res.summary[k].name + "/D").c_str());
+	for(size_t r = 0; r < res.nrep; r++) {
+		const double* v = res.replica(r);
+		if( res.nobs == 0 || std::isnan(v[0]) ) continue;
+		replica = r;
+		for(size_t k = 0; k < res.nobs; k++) row[k] = v[k];
+		t->Fill();
+	}
+	t->Write();
+	t->ResetBranchAddresses();
+	return t;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef CALIB_SERVICE_H
+#define CALIB_SERVICE_H
+/***
+ * File: calib_service.h
+ *
+ * Discription:
+ *	ROOT front end to energy_calib.h. open_calib_service(path) reads
+ *	GAM1_EC_FIT / GAM2_EC_FIT from the energy_calib.root written by
+ *	energy_calibration once, closes the file, and from then on hands
+ *	out lookup tables for any source binning:
+ *
+ *	  CalibService* cal = open_calib_service("../Rootfiles/energy_calibration/energy_calib.root");
+ *	  int xlow, xhigh;
+ *	  cal->window(0, h, 415, 600, xlow, xhigh);          // keV -> bins of h
+ *	  TH1F* e = cal->energy_hist(h, 0, { 1500, 0, 1500 }, "gam1_keV");
+ *
+ *	Detectors are 0 (gam1, g11, g12) and 1 (gam2, g21, g22), see
+ *	detector_of_subtag. Tables are kept per (detector, binning), so
+ *	rebinning thousands of spectra of one binning builds one table and
+ *	one rebinning map per detector.
+ **/
+#include <iostream>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "TFile.h"
+#include "TFitResult.h"
+#include "TH1F.h"
+
+#include "energy_calib.h"
+#include "stageprof.h"
+
+#define CALIB_NDET 2
+
+static const char* _calib_fit_names[CALIB_NDET] = { "GAM1_EC_FIT", "GAM2_EC_FIT" };
+
+/*
+ * Class: CalibService
+ * Brief:
+ *	Linear calibrations of both detectors and their lookup tables.
+ * Comments:
+ *	Check isOpen() before use. Safe to share between threads once
+ *	opened; histograms must still be created on one thread.
+ */
+class CalibService
+{
+public:
+	CalibService(const char* path);
+
+public:
+	bool isOpen() const { return _open; }
+	const std::string& path() const { return _path; }
+	const linear_calib_t& calib(int det) const { return _cal[det]; }
+
+	const EnergyLUT* lut(int det, int nbins, double xmin, double xmax) const;
+	const EnergyLUT* lut(int det, const TH1* h) const;
+
+	bool  window(int det, const TH1* h, double elo, double ehi, int& xlow, int& xhigh) const;
+	TH1F* energy_hist(const TH1* h, int det, const energy_axis_t& axis, const char* name) const;
+
+private:
+	std::string _path;
+	bool _open;
+	linear_calib_t _cal[CALIB_NDET];
+	mutable std::mutex _m;
+	mutable std::map<std::tuple<int,int,double,double>, std::unique_ptr<EnergyLUT>> _luts;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+CalibService::CalibService(const char* path) : _path(path), _open(false)
+{
+	PROF_SCOPE(st_parse);
+	TFile f(path, "READ");
+	if( f.IsZombie() ) {
+		std::cout << "ERROR: CANNOT OPEN CALIBRATION " << path << std::endl;
+		return;
+	}
+	for(int d = 0; d < CALIB_NDET; d++) {
+		TFitResult* r = (TFitResult*)f.Get(_calib_fit_names[d]);
+		if( r == NULL || r->NPar() < 2 ) {
+			std::cout << "ERROR: NO " << _calib_fit_names[d] << " IN " << path << std::endl;
+			delete r;
+			return;
+		}
+		_cal[d].offset = r->Parameter(0);
+		_cal[d].gain   = r->Parameter(1);
+		for(int i = 0; i < 2; i++)
+			for(int j = 0; j < 2; j++) _cal[d].cov[i][j] = r->CovMatrix(i, j);
+		delete r;
+		if( !(_cal[d].gain > 0) ) {
+			std::cout << "ERROR: " << _calib_fit_names[d] << " IN " << path << " HAS GAIN " << _cal[d].gain << std::endl;
+			return;
+		}
+	}
+	PROF_COUNT(st_parse, f.GetBytesRead(), 0);
+	_open = true;
+}
+
+/*
+ * Func: lut
+ * Brief:
+ *	Lookup table of detector det for nbins bins on [xmin, xmax], built
+ *	on first use. NULL for a bad detector or an unopened service.
+ */
+const EnergyLUT* CalibService::lut(int det, int nbins, double xmin, double xmax) const
+{
+	if( !_open || det < 0 || det >= CALIB_NDET ) return NULL;
+	std::lock_guard<std::mutex> lk(_m);
+	std::unique_ptr<EnergyLUT>& l = _luts[std::make_tuple(det, nbins, xmin, xmax)];
+	if( !l ) l.reset( new EnergyLUT(_cal[det], nbins, xmin, xmax) );
+	return l.get();
+}
+
+const EnergyLUT* CalibService::lut(int det, const TH1* h) const
+{
+	const TAxis* ax = h->GetXaxis();
+	return lut(det, h->GetNbinsX(), ax->GetXmin(), ax->GetXmax());
+}
+
+/*
+ * Func: window
+ * Brief:
+ *	Bins of h whose centre energy lies in [elo, ehi] keV.
+ */
+bool CalibService::window(int det, const TH1* h, double elo, double ehi, int& xlow, int& xhigh) const
+{
+	const EnergyLUT* l = lut(det, h);
+	if( l == NULL || !l->window(elo, ehi, xlow, xhigh) ) {
+		std::cout << "ERROR: NO BINS OF " << h->GetName() << " IN [" << elo << ", " << ehi << "] keV" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Func: energy_hist
+ * Brief:
+ *	Returns a new Counts vs Energy histogram "name" on axis holding h
+ *	rebinned with the calibration of detector det, NULL on failure.
+ * Comments:
+ *	Counts outside the axis go to its under/overflow. The histogram is
+ *	attached to the current directory.
+ */
+TH1F* CalibService::energy_hist(const TH1* h, int det, const energy_axis_t& axis, const char* name) const
+{
+	const EnergyLUT* l = lut(det, h);
+	if( l == NULL ) {
+		std::cout << "ERROR: NO CALIBRATION FOR DETECTOR " << det << " (" << h->GetName() << ")" << std::endl;
+		return NULL;
+	}
+	const TH1F* hf = dynamic_cast<const TH1F*>(h);
+	if( hf == NULL ) {
+		std::cout << "ERROR: ENERGY_HIST() EXPECTS A TH1F, GOT " << h->ClassName() << std::endl;
+		return NULL;
+	}
+	PROF_SCOPE(st_histo);
+	static thread_local std::vector<double> out, outvar;
+	out.resize(axis.nbins+2);
+	outvar.resize(axis.nbins+2);
+	l->rebin<float>(hf->GetArray(), hf->GetSumw2N() ? hf->GetSumw2()->GetArray() : NULL, axis, out.data(), outvar.data());
+
+	TH1F* e = new TH1F(name, name, axis.nbins, axis.emin, axis.emax);
+	e->Sumw2();
+	float*  content = e->GetArray();
+	double* sumw2   = e->GetSumw2()->GetArray();
+	for(int i = 0; i < axis.nbins+2; i++) {
+		content[i] = (float)out[i];
+		sumw2[i]   = outvar[i];
+	}
+	e->SetEntries( h->GetEntries() );
+	e->SetTitle( h->GetTitle() );
+	e->GetXaxis()->SetTitle("Energy [keV]");
+	e->GetYaxis()->SetTitle("Counts");
+	PROF_COUNT(st_histo, 0, 1);
+	return e;
+}
+
+/*
+ * Func: open_calib_service
+ * Brief:
+ *	Service for calibration file path, read on the first call for that
+ *	path only. Returns NULL if the file lacks either fit.
+ */
+static inline CalibService* open_calib_service(const std::string& path)
+{
+	static std::mutex m;
+	static std::map<std::string, std::unique_ptr<CalibService>> services;
+	std::lock_guard<std::mutex> lk(m);
+	std::unique_ptr<CalibService>& s = services[path];
+	if( !s ) s.reset( new CalibService(path.c_str()) );
+	return s->isOpen() ? s.get() : NULL;
+}
+
+#endif
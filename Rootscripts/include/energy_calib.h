@@ -0,0 +1,208 @@
+#ifndef ENERGY_CALIB_H
+#define ENERGY_CALIB_H
+/***
+ * File: energy_calib.h
+ *
+ * Discription:
+ *	Channel -> energy lookup for one detector. The linear calibration
+ *	E = offset + gain * x (x in histogram units, what energy_calibration
+ *	fits against) is evaluated once at every bin edge of the source
+ *	axis. With that
+ *
+ *	  - a window in keV becomes a bin range by a binary search, and
+ *	  - rebinning onto a common keV axis is one pass over a precomputed
+ *	    list of (source bin, target bin, overlap fraction) entries.
+ *
+ *	The entry list depends only on the two axes, so it is built once
+ *	per target axis and shared by every spectrum rebinned with it.
+ *
+ *	Nothing in here depends on ROOT.
+ **/
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+struct linear_calib_t
+{
+	double offset = 0, gain = 1;           // E = offset + gain*x [keV]
+	double cov[2][2] = { { 0, 0 }, { 0, 0 } };
+};
+
+// Fixed width energy axis, TH1 bin numbering
+struct energy_axis_t
+{
+	int    nbins = 0;
+	double emin = 0, emax = 0;             // keV
+	bool operator<(const energy_axis_t& o) const
+	{
+		if(nbins != o.nbins) return nbins < o.nbins;
+		if(emin  != o.emin)  return emin  < o.emin;
+		return emax < o.emax;
+	}
+};
+
+/*
+ * Struct: rebin_map_t
+ * Brief:
+ *	Sparse rebinning matrix, one entry per (source bin, target bin)
+ *	overlap, sorted by source bin. tgt uses TH1 numbering of the
+ *	target axis, so energies below/above it land in bin 0 / nbins+1.
+ */
+struct rebin_map_t
+{
+	energy_axis_t axis;
+	std::vector<int>    src, tgt;
+	std::vector<double> frac;
+};
+
+/*
+ * Class: EnergyLUT
+ * Brief:
+ *	Calibration of one detector evaluated on the bin edges of a source
+ *	axis (nbins fixed width bins on [xmin, xmax]).
+ * Comments:
+ *	Assumes gain > 0, so energy increases with channel.
+ */
+class EnergyLUT
+{
+public:
+	EnergyLUT(const linear_calib_t& cal, int nbins, double xmin, double xmax);
+
+public:
+	const linear_calib_t& calib() const { return _cal; }
+	int    nbins() const { return _nbins; }
+	double low_edge(int bin) const { return _edge[bin-1]; }        // bins 1..nbins
+	double centre(int bin)   const { return 0.5*(_edge[bin-1] + _edge[bin]); }
+
+	bool window(double elo, double ehi, int& xlow, int& xhigh) const;
+	const rebin_map_t& rebin_map(const energy_axis_t& axis) const;
+
+	template<class T>
+	void rebin(const T* content, const double* var, const energy_axis_t& axis, double* out, double* outvar) const;
+
+private:
+	linear_calib_t _cal;
+	int    _nbins;
+	double _xmin, _xmax;
+	std::vector<double> _edge;     // nbins+1 edges in keV
+	mutable std::mutex _m;
+	mutable std::map<energy_axis_t, std::unique_ptr<rebin_map_t>> _maps;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+EnergyLUT::EnergyLUT(const linear_calib_t& cal, int nbins, double xmin, double xmax)
+	: _cal(cal), _nbins(nbins), _xmin(xmin), _xmax(xmax), _edge(nbins+1)
+{
+	const double w = (xmax - xmin)/nbins;
+	for(int k = 0; k <= nbins; k++) _edge[k] = cal.offset + cal.gain*(xmin + k*w);
+}
+
+/*
+ * Func: window
+ * Brief:
+ *	Bins whose centre energy lies in [elo, ehi]. Returns false (and an
+ *	empty range xlow > xhigh) if there are none.
+ */
+bool EnergyLUT::window(double elo, double ehi, int& xlow, int& xhigh) const
+{
+	// centre(b) >= elo  <=>  edge[b-1] + edge[b] >= 2 elo; centres are increasing
+	int lo = 1, hi = _nbins + 1;
+	while(lo < hi) {
+		int mid = (lo + hi)/2;
+		if( centre(mid) >= elo ) hi = mid; else lo = mid + 1;
+	}
+	xlow = lo;
+	lo = 0; hi = _nbins;
+	while(lo < hi) {
+		int mid = (lo + hi + 1)/2;
+		if( centre(mid) <= ehi ) lo = mid; else hi = mid - 1;
+	}
+	xhigh = lo;
+	return xlow <= xhigh;
+}
+
+/*
+ * Func: rebin_map
+ * Brief:
+ *	Entry list for rebinning onto axis, built on first use. Every
+ *	source bin is spread over the target bins it overlaps in
+ *	proportion to the overlap, i.e. counts are taken as flat within a
+ *	channel.
+ */
+const rebin_map_t& EnergyLUT::rebin_map(const energy_axis_t& axis) const
+{
+	std::lock_guard<std::mutex> lk(_m);
+	std::unique_ptr<rebin_map_t>& m = _maps[axis];
+	if(m) return *m;
+	m.reset( new rebin_map_t );
+	m->axis = axis;
+	const double tw = (axis.emax - axis.emin)/axis.nbins;
+	for(int s = 1; s <= _nbins; s++) {
+		double e0 = _edge[s-1], e1 = _edge[s];
+		double de = e1 - e0;
+		if( !(de > 0) ) continue;
+		// Target bins touched, clamped to [0, nbins+1]
+		double u0 = (e0 - axis.emin)/tw, u1 = (e1 - axis.emin)/tw;
+		int t0 = (int)std::floor(u0) + 1, t1 = (int)std::floor(u1) + 1;
+		t0 = std::max(0, std::min(t0, axis.nbins+1));
+		t1 = std::max(0, std::min(t1, axis.nbins+1));
+		for(int t = t0; t <= t1; t++) {
+			double lo = (t == 0)            ? e0 : std::max(e0, axis.emin + (t-1)*tw);
+			double hi = (t == axis.nbins+1) ? e1 : std::min(e1, axis.emin + t*tw);
+			if( hi <= lo ) continue;
+			m->src.push_back(s);
+			m->tgt.push_back(t);
+			m->frac.push_back( (hi - lo)/de );
+		}
+	}
+	return *m;
+}
+
+/*
+ * Func: rebin
+ * Brief:
+ *	out / outvar (axis.nbins+2 cells, TH1 layout) = content / var of
+ *	the source spectrum (nbins+2 cells) moved onto axis. var may be
+ *	NULL for raw counts.
+ * Comments:
+ *	A split bin contributes frac^2 * var to each target bin, as for a
+ *	scaled histogram; neighbouring target bins are then correlated.
+ */
+template<class T>
+void EnergyLUT::rebin(const T* content, const double* var, const energy_axis_t& axis, double* out, double* outvar) const
+{
+	const rebin_map_t& m = rebin_map(axis);
+	std::fill(out, out + axis.nbins + 2, 0.0);
+	std::fill(outvar, outvar + axis.nbins + 2, 0.0);
+	const int*    src  = m.src.data();
+	const int*    tgt  = m.tgt.data();
+	const double* frac = m.frac.data();
+	const size_t  n    = m.src.size();
+	for(size_t i = 0; i < n; i++) {
+		double c = content[src[i]];
+		double v = var ? var[src[i]] : c;
+		out[tgt[i]]    += frac[i]*c;
+		outvar[tgt[i]] += frac[i]*frac[i]*v;
+	}
+}
+
+// Detector of a subtag: gam1, g11, g12 are detector 0, gam2, g21, g22 detector 1, -1 otherwise
+static inline int detector_of_subtag(const char* hname)
+{
+	static const char* det0[] = { "gam1", "g11", "g12" };
+	static const char* det1[] = { "gam2", "g21", "g22" };
+	for(int i = 0; i < 3; i++) {
+		if( std::strcmp(hname, det0[i]) == 0 ) return 0;
+		if( std::strcmp(hname, det1[i]) == 0 ) return 1;
+	}
+	return -1;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef PEAK_RECORD_H
+#define PEAK_RECORD_H
+/***
+ * File: peak_record.h
+ *
+ * Discription:
+ *	ROOT side of peakfit.h: stores a window fitted by fit_peak_batch
+ *	in the peak tree of an analysis macro and saves its fit function
+ *	and histogram. Shared by attenuation and energy_calibration.
+ *
+ *	Each window is one branch <name> of six leaves
+ *	  xlow, xhigh, mean, sigma, counts, cts_error
+ *	where counts is either the raw window sum (pc_window) or the
+ *	fitted net area (pc_net), see peak_counts.
+ **/
+#include <iostream>
+#include <string>
+#include <cmath>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TCanvas.h"
+#include "TH1F.h"
+#include "TF1.h"
+#include "TString.h"
+
+#include "peakfit.h"
+
+// What the counts leaf holds
+enum peak_counts
+{
+	pc_window = 0,   // sum of bins [xlow, xhigh], error from the bin variances
+	pc_net    = 1    // window sum minus the fitted line (peak_result_t::net)
+};
+
+// A peak window to be fitted; c may be NULL to skip drawing
+struct peak_window_t
+{
+	TTree* t;
+	TCanvas* c;
+	int pad;
+	TH1F* h;
+	int xlow, xhigh;
+	std::string name;
+};
+
+/*
+ * Func: record_peak
+ * Brief:
+ *	Fills branch w.name of w.t with the fit result and writes
+ *	<name>_fit (gaus+pol1 with the fitted parameters) and <name>_hist
+ *	to file. counts selects the counts leaf (peak_counts).
+ * Comments:
+ *	<name>_hist is the window: titled <name> with its axis range set
+ *	to [xlow, xhigh+1]. It is only cloned, and the fit only drawn,
+ *	when the window has a canvas. The fit function is one TF1 reused
+ *	for every peak.
+ */
+static inline void record_peak(TFile* file, const peak_window_t& w, const peak_result_t& res, int counts)
+{
+	static TF1* fn = new TF1("record_peak_fn", "gaus(0)+pol1(3)", 0, 1);
+	const int xlow = w.xlow, xhigh = w.xhigh;
+	const char* name = w.name.c_str();
+	fn->SetRange( w.h->GetBinLowEdge(xlow), w.h->GetBinLowEdge(xhigh+1) );
+	fn->SetParameters(res.par);
+	if(res.status != pf_ok) std::cout << name << "\t|\tWARNING: fit status " << res.status << std::endl;
+
+	// the saved histogram shows the window: a clone owned by the pad when
+	// drawing, otherwise w.h itself, restored after it is written
+	TH1F* h = w.h;
+	const TString title = w.h->GetTitle();
+	const Color_t color = w.h->GetLineColor();
+	const int first = w.h->GetXaxis()->GetFirst(), last = w.h->GetXaxis()->GetLast();
+	const bool ranged = w.h->GetXaxis()->TestBit(TAxis::kAxisRange);
+	if(w.c) {
+		w.c->cd(w.pad);
+		h = (TH1F*)w.h->Clone();
+		h->SetDirectory(0);
+		h->SetBit(kCanDelete);
+	}
+	h->SetTitle(name);
+	h->SetLineColor(kBlue);
+	h->GetXaxis()->SetRange(xlow, xhigh+1);
+	if(w.c) {
+		h->Draw();
+		fn->DrawCopy("SAME");
+	}
+
+	double cts, cts_err;
+	if(counts == pc_net) {
+		cts = res.net; cts_err = res.net_err;
+	}
+	else {
+		const float*  content = w.h->GetArray();
+		const double* sumw2   = w.h->GetSumw2N() ? w.h->GetSumw2()->GetArray() : NULL;
+		double var = 0;
+		cts = 0;
+		for(int bin = xlow; bin <= xhigh; bin++) {
+			cts += content[bin];
+			var += sumw2 ? sumw2[bin] : content[bin];
+		}
+		cts_err = std::sqrt(var);
+	}
+	std::cout << name << "\t|\tMean: " << res.mean << " +- " << res.mean_err << "\tSigma: " << res.sigma
+	          << "\tCounts: " << cts << " +- " << cts_err << "\tChi2/NDF: " << res.chi2 << "/" << res.ndf << std::endl;
+
+	// Fill tree with peak info
+	double bvals[] = { (double)xlow, (double)xhigh, res.mean, res.sigma, cts, cts_err };
+	TBranch* branch = w.t->Branch(name, &bvals, "xlow/D:xhigh/D:mean/D:sigma/D:counts/D:cts_error/D");
+	branch->Fill();
+	w.t->Fill();
+	w.t->ResetBranchAddress(branch);
+
+	// save
+	file->cd();
+	fn->Write(Form("%s_fit", name));
+	h->Write(Form("%s_hist", name));
+	if(h == w.h) {
+		w.h->SetTitle(title);
+		w.h->SetLineColor(color);
+		if(ranged) w.h->GetXaxis()->SetRange(first, last);
+		else       w.h->GetXaxis()->UnZoom();
+	}
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef PEAKFIT_H
+#define PEAKFIT_H
+/***
+ * File: peakfit.h
+ *
+ * Discription:
+ *	Levenberg-Marquardt fitter for a single photo peak on a linear
+ *	background,
+ *
+ *	  f(x) = A exp( -(x-mu)^2 / (2 s^2) ) + b0 + b1 x
+ *
+ *	i.e. the same model as ROOT's "gaus(0)+pol1(3)". The Jacobian is
+ *	written out by hand and the starting values come from the moments
+ *	of the background subtracted window, so no trial fit is needed.
+ *	fit_peak_batch(...) fits many (spectrum, window) jobs across cores
+ *	and returns one peak_result_t per job.
+ *
+ *	Nothing in here depends on ROOT; make_peak_job(...) only needs the
+ *	TH1 bin accessors, so it is a template.
+ **/
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "workpool.h"
+
+#define PF_NPAR 5
+enum pf_par { pf_amp = 0, pf_mean = 1, pf_sigma = 2, pf_b0 = 3, pf_b1 = 4 };
+enum pf_status { pf_ok = 0, pf_maxiter = 1, pf_failed = 2 };
+
+struct peak_job_t
+{
+	std::vector<double> x;    // bin centres of the window
+	std::vector<double> y;    // contents
+	std::vector<double> e;    // errors (bins with e <= 0 are skipped, like ROOT)
+	double width = 1.0;       // bin width, to turn the peak height into an area
+};
+
+struct peak_result_t
+{
+	double par[PF_NPAR];           // A, mu, sigma, b0, b1
+	double cov[PF_NPAR][PF_NPAR];  // covariance of par
+	double chi2;
+	int    ndf;
+	int    niter;
+	int    status;                 // pf_status
+
+	double mean,  mean_err;
+	double sigma, sigma_err;
+	double area,  area_err;        // Gaussian area, A*sigma*sqrt(2pi)/width
+	double net,   net_err;         // window sum minus the fitted line
+};
+
+// Copy bins [xlow, xhigh] of histogram h into a fit job
+template<class H>
+peak_job_t make_peak_job(const H* h, const int xlow, const int xhigh)
+{
+	peak_job_t job;
+	for(int bin = xlow; bin <= xhigh; bin++) {
+		job.x.push_back( h->GetBinCenter(bin) );
+		job.y.push_back( h->GetBinContent(bin) );
+		job.e.push_back( h->GetBinError(bin) );
+	}
+	job.width = h->GetBinWidth(xlow);
+	return job;
+}
+
+// Same from contents and variances in TH1 layout (bin b has centre xmin + (b-0.5)*width)
+static inline peak_job_t make_peak_job(const double* content, const double* var, const int xlow, const int xhigh,
+                                       const double xmin, const double width)
+{
+	peak_job_t job;
+	for(int bin = xlow; bin <= xhigh; bin++) {
+		job.x.push_back( xmin + (bin - 0.5)*width );
+		job.y.push_back( content[bin] );
+		job.e.push_back( std::sqrt( std::fmax(var[bin], 0.0) ) );
+	}
+	job.width = width;
+	return job;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Func: _pf_model
+ * Brief:
+ *	Evaluates f(u) and df/dp for the parameters p. u is x measured from
+ *	the window centre (keeps b0 and b1 from being strongly correlated).
+ */
+static inline double _pf_model(const double* p, double u, double* grad)
+{
+	double d  = u - p[pf_mean];
+	double s  = p[pf_sigma];
+	double g  = std::exp( -0.5*d*d/(s*s) );
+	double Ag = p[pf_amp]*g;
+	if(grad) {
+		grad[pf_amp]   = g;
+		grad[pf_mean]  = Ag*d/(s*s);
+		grad[pf_sigma] = Ag*d*d/(s*s*s);
+		grad[pf_b0]    = 1.0;
+		grad[pf_b1]    = u;
+	}
+	return Ag + p[pf_b0] + p[pf_b1]*u;
+}
+
+/*
+ * Func: _pf_cholesky
+ * Brief:
+ *	In place Cholesky factorisation of the symmetric positive definite
+ *	n x n matrix a (lower triangle). Returns false if a is not positive
+ *	definite.
+ */
+static inline bool _pf_cholesky(double a[PF_NPAR][PF_NPAR], int n)
+{
+	for(int j = 0; j < n; j++) {
+		double d = a[j][j];
+		for(int k = 0; k < j; k++) d -= a[j][k]*a[j][k];
+		if( !(d > 0) ) return false;
+		a[j][j] = std::sqrt(d);
+		for(int i = j+1; i < n; i++) {
+			double s = a[i][j];
+			for(int k = 0; k < j; k++) s -= a[i][k]*a[j][k];
+			a[i][j] = s / a[j][j];
+		}
+	}
+	return true;
+}
+
+// Solves L L^T x = b for a factorised matrix
+static inline void _pf_cholesky_solve(const double l[PF_NPAR][PF_NPAR], int n, const double* b, double* x)
+{
+	double y[PF_NPAR];
+	for(int i = 0; i < n; i++) {
+		double s = b[i];
+		for(int k = 0; k < i; k++) s -= l[i][k]*y[k];
+		y[i] = s / l[i][i];
+	}
+	for(int i = n-1; i >= 0; i--) {
+		double s = y[i];
+		for(int k = i+1; k < n; k++) s -= l[k][i]*x[k];
+		x[i] = s / l[i][i];
+	}
+}
+
+/*
+ * Func: _pf_normal_equations
+ * Brief:
+ *	Builds J^T W J and J^T W r at p and returns chi2.
+ */
+static inline double _pf_normal_equations(const peak_job_t& job, double xc, const double* p, double jtj[PF_NPAR][PF_NPAR], double* jtr)
+{
+	std::memset(jtj, 0, sizeof(double)*PF_NPAR*PF_NPAR);
+	std::memset(jtr, 0, sizeof(double)*PF_NPAR);
+	double chi2 = 0;
+	double grad[PF_NPAR];
+	for(size_t i = 0; i < job.x.size(); i++) {
+		if( !(job.e[i] > 0) ) continue;
+		double w = 1.0 / (job.e[i]*job.e[i]);
+		double r = job.y[i] - _pf_model(p, job.x[i] - xc, grad);
+		chi2 += w*r*r;
+		for(int a = 0; a < PF_NPAR; a++) {
+			jtr[a] += w*grad[a]*r;
+			for(int b = 0; b <= a; b++) jtj[a][b] += w*grad[a]*grad[b];
+		}
+	}
+	for(int a = 0; a < PF_NPAR; a++)
+		for(int b = a+1; b < PF_NPAR; b++) jtj[a][b] = jtj[b][a];
+	return chi2;
+}
+
+static inline double _pf_chi2(const peak_job_t& job, double xc, const double* p)
+{
+	double chi2 = 0;
+	for(size_t i = 0; i < job.x.size(); i++) {
+		if( !(job.e[i] > 0) ) continue;
+		double r = (job.y[i] - _pf_model(p, job.x[i] - xc, NULL)) / job.e[i];
+		chi2 += r*r;
+	}
+	return chi2;
+}
+
+/*
+ * Func: peak_seed
+ * Brief:
+ *	Starting values from moments: a line through the mean of the
+ *	outer tenth of the window on each side, then mean, width and
+ *	height of what is left above it. p is in window centred
+ *	coordinates (u = x - xc).
+ */
+static inline void peak_seed(const peak_job_t& job, double xc, double* p)
+{
+	int n = (int)job.x.size();
+	int k = n/10 > 0 ? n/10 : 1;
+	double yl = 0, ul = 0, yr = 0, ur = 0;
+	for(int i = 0; i < k; i++) {
+		yl += job.y[i];       ul += job.x[i] - xc;
+		yr += job.y[n-1-i];   ur += job.x[n-1-i] - xc;
+	}
+	yl /= k; ul /= k; yr /= k; ur /= k;
+	p[pf_b1] = (ur != ul) ? (yr - yl)/(ur - ul) : 0;
+	p[pf_b0] = yl - p[pf_b1]*ul;
+
+	double sw = 0, su = 0, suu = 0, ymax = 0;
+	for(int i = 0; i < n; i++) {
+		double u   = job.x[i] - xc;
+		double net = job.y[i] - (p[pf_b0] + p[pf_b1]*u);
+		if(net <= 0) continue;
+		sw  += net;
+		su  += net*u;
+		suu += net*u*u;
+		if(net > ymax) ymax = net;
+	}
+	double half = 0.5*(job.x[n-1] - job.x[0]);
+	if(sw > 0) {
+		p[pf_mean]  = su/sw;
+		p[pf_sigma] = std::sqrt( std::fmax(suu/sw - p[pf_mean]*p[pf_mean], 0.0) );
+	}
+	else {
+		p[pf_mean]  = 0;
+		p[pf_sigma] = half/2;
+	}
+	// The window usually clips the tails, which biases the rms low
+	if(p[pf_sigma] < job.width) p[pf_sigma] = job.width;
+	p[pf_amp] = ymax;
+}
+
+/*
+ * Func: fit_peak
+ * Brief:
+ *	Levenberg-Marquardt minimisation of chi2 for one window.
+ * Comments:
+ *	The covariance is the inverse of J^T W J at the minimum, which is
+ *	what Minuit's HESSE gives for a chi2 fit.
+ */
+static inline peak_result_t fit_peak(const peak_job_t& job, int maxiter = 200)
+{
+	peak_result_t res;
+	std::memset(&res, 0, sizeof(res));
+	res.status = pf_failed;
+	int n = (int)job.x.size();
+	int nused = 0;
+	for(int i = 0; i < n; i++) if(job.e[i] > 0) nused++;
+	if(nused <= PF_NPAR) return res;
+
+	double xc = 0.5*(job.x[0] + job.x[n-1]);
+	double p[PF_NPAR];
+	peak_seed(job, xc, p);
+
+	double jtj[PF_NPAR][PF_NPAR], jtr[PF_NPAR];
+	double chi2   = _pf_normal_equations(job, xc, p, jtj, jtr);
+	double lambda = 1e-3;
+	int iter;
+	res.status = pf_maxiter;
+	for(iter = 0; iter < maxiter; iter++) {
+		bool improved = false;
+		double pnew[PF_NPAR], chi2new = chi2;
+		while(lambda < 1e12) {
+			double a[PF_NPAR][PF_NPAR], dp[PF_NPAR];
+			std::memcpy(a, jtj, sizeof(a));
+			for(int k = 0; k < PF_NPAR; k++) a[k][k] *= (1.0 + lambda);
+			if( _pf_cholesky(a, PF_NPAR) ) {
+				_pf_cholesky_solve(a, PF_NPAR, jtr, dp);
+				for(int k = 0; k < PF_NPAR; k++) pnew[k] = p[k] + dp[k];
+				pnew[pf_sigma] = std::fabs(pnew[pf_sigma]);
+				chi2new = _pf_chi2(job, xc, pnew);
+				if(chi2new < chi2) { improved = true; break; }
+			}
+			lambda *= 10;
+		}
+		if(!improved) { res.status = pf_ok; break; } // no downhill step left
+		double dchi2 = chi2 - chi2new;
+		std::memcpy(p, pnew, sizeof(p));
+		chi2    = _pf_normal_equations(job, xc, p, jtj, jtr);
+		lambda  = std::fmax(lambda/10, 1e-12);
+		if(dchi2 < 1e-9*(1.0 + chi2)) { res.status = pf_ok; break; }
+	}
+	res.niter = iter;
+
+	// Covariance in window coordinates
+	double l[PF_NPAR][PF_NPAR], cu[PF_NPAR][PF_NPAR];
+	std::memcpy(l, jtj, sizeof(l));
+	if( !_pf_cholesky(l, PF_NPAR) ) { res.status = pf_failed; return res; }
+	for(int j = 0; j < PF_NPAR; j++) {
+		double unit[PF_NPAR] = { 0 }, col[PF_NPAR];
+		unit[j] = 1;
+		_pf_cholesky_solve(l, PF_NPAR, unit, col);
+		for(int i = 0; i < PF_NPAR; i++) cu[i][j] = col[i];
+	}
+
+	// Back to channel coordinates: mu = mu_u + xc, b0 = b0_u - b1*xc
+	double t[PF_NPAR][PF_NPAR] = { { 0 } };
+	for(int i = 0; i < PF_NPAR; i++) t[i][i] = 1;
+	t[pf_b0][pf_b1] = -xc;
+	for(int i = 0; i < PF_NPAR; i++)
+		for(int j = 0; j < PF_NPAR; j++) {
+			double s = 0;
+			for(int a = 0; a < PF_NPAR; a++)
+				for(int b = 0; b < PF_NPAR; b++) s += t[i][a]*cu[a][b]*t[j][b];
+			res.cov[i][j] = s;
+		}
+	std::memcpy(res.par, p, sizeof(p));
+	res.par[pf_mean] = p[pf_mean] + xc;
+	res.par[pf_b0]   = p[pf_b0] - p[pf_b1]*xc;
+	res.chi2 = chi2;
+	res.ndf  = nused - PF_NPAR;
+
+	res.mean      = res.par[pf_mean];
+	res.mean_err  = std::sqrt( res.cov[pf_mean][pf_mean] );
+	res.sigma     = res.par[pf_sigma];
+	res.sigma_err = std::sqrt( res.cov[pf_sigma][pf_sigma] );
+
+	// Gaussian area
+	const double sqrt2pi = std::sqrt(2*M_PI);
+	double dA = res.sigma*sqrt2pi/job.width, dS = res.par[pf_amp]*sqrt2pi/job.width;
+	res.area     = res.par[pf_amp]*dA;
+	res.area_err = std::sqrt( dA*dA*res.cov[pf_amp][pf_amp] + dS*dS*res.cov[pf_sigma][pf_sigma] + 2*dA*dS*res.cov[pf_amp][pf_sigma] );
+
+	// Window sum minus the line under it
+	double sy = 0, se2 = 0, sx = 0;
+	for(int i = 0; i < n; i++) { sy += job.y[i]; se2 += job.e[i]*job.e[i]; sx += job.x[i]; }
+	double line     = n*res.par[pf_b0] + sx*res.par[pf_b1];
+	double line_var = n*n*res.cov[pf_b0][pf_b0] + sx*sx*res.cov[pf_b1][pf_b1] + 2*n*sx*res.cov[pf_b0][pf_b1];
+	res.net     = sy - line;
+	res.net_err = std::sqrt( se2 + line_var );
+	return res;
+}
+
+/*
+ * Func: fit_peak_batch
+ * Brief:
+ *	Fits every job on pool and returns the results in the same order.
+ * Comments:
+ *	Lets a caller fitting many batches keep one pool for all of them
+ *	instead of starting and joining threads per batch.
+ */
+static inline std::vector<peak_result_t> fit_peak_batch(WorkPool& pool, const std::vector<peak_job_t>& jobs)
+{
+	std::vector<peak_result_t> results(jobs.size());
+	// A few jobs per task so tiny fits don't drown in queue overhead
+	size_t chunk = jobs.size() / (4*pool.size()) + 1;
+	for(size_t first = 0; first < jobs.size(); first += chunk) {
+		size_t last = std::min(first + chunk, jobs.size());
+		pool.submit( [&jobs, &results, first, last]{
+			for(size_t i = first; i < last; i++) results[i] = fit_peak(jobs[i]);
+		} );
+	}
+	pool.wait();
+	return results;
+}
+
+/*
+ * Func: fit_peak_batch
+ * Brief:
+ *	Fits every job and returns the results in the same order.
+ *	nthreads = 0 uses every core, 1 fits in the calling thread.
+ */
+static inline std::vector<peak_result_t> fit_peak_batch(const std::vector<peak_job_t>& jobs, unsigned nthreads = 0)
+{
+	if(nthreads == 1 || jobs.size() < 2) {
+		std::vector<peak_result_t> results(jobs.size());
+		for(size_t i = 0; i < jobs.size(); i++) results[i] = fit_peak(jobs[i]);
+		return results;
+	}
+	WorkPool pool(nthreads);
+	return fit_peak_batch(pool, jobs);
+}
+
+#endif
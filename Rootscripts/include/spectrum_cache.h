@@ -0,0 +1,193 @@
+#ifndef SPECTRUM_CACHE_H
+#define SPECTRUM_CACHE_H
+/***
+ * File: spectrum_cache.h
+ *
+ * Discription:
+ *	Prefix sum index of a spectrum, so the sum of any channel window
+ *	and its variance cost two subtractions, and an LRU cache of such
+ *	indices bounded by memory.
+ *
+ *	The cache does not know where spectra come from; a miss calls the
+ *	loader handed to get(...). spectrum_source.h wires it to ROOT
+ *	files and archives (get_spectrum_index).
+ *
+ *	Nothing in here depends on ROOT.
+ **/
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Struct: window_index_t
+ * Brief:
+ *	Cumulative contents and variances of a spectrum in TH1 bin
+ *	numbering (bin 0 underflow, bins 1..nbins, nbins+1 overflow):
+ *	  csum[b] = sum of bins [0, b)
+ *	so bins [xlow, xhigh] sum to csum[xhigh+1] - csum[xlow].
+ * Comments:
+ *	Counts are integers well below 2^53, so the differences are exact
+ *	for raw spectra.
+ */
+struct window_index_t
+{
+	int    nbins = 0;
+	double xmin = 0, xmax = 0;      // axis range, to turn x values into bins
+	std::vector<double> csum;       // nbins+3 entries
+	std::vector<double> cvar;
+
+	size_t bytes() const { return sizeof(*this) + (csum.capacity() + cvar.capacity())*sizeof(double); }
+
+	// Sum over bins [xlow, xhigh] (clipped to [0, nbins+1]), like TH1::Integral(xlow, xhigh)
+	double sum(int xlow, int xhigh, double* var = NULL) const
+	{
+		if(xlow < 0) xlow = 0;
+		if(xhigh > nbins+1) xhigh = nbins+1;
+		if(xhigh < xlow) { if(var) *var = 0; return 0; }
+		if(var) *var = cvar[xhigh+1] - cvar[xlow];
+		return csum[xhigh+1] - csum[xlow];
+	}
+
+	// Bin holding x (0 / nbins+1 outside the axis), like TAxis::FindBin
+	int find_bin(double x) const
+	{
+		if(x <  xmin) return 0;
+		if(x >= xmax) return nbins+1;
+		return 1 + (int)( nbins*(x - xmin)/(xmax - xmin) );
+	}
+};
+
+/*
+ * Func: build_window_index
+ * Brief:
+ *	Fills idx from nbins+2 contents (TH1 layout). var may be NULL for
+ *	raw counts (var = content).
+ */
+template<class T>
+static inline void build_window_index(window_index_t& idx, const T* content, const double* var, int nbins, double xmin, double xmax)
+{
+	idx.nbins = nbins; idx.xmin = xmin; idx.xmax = xmax;
+	idx.csum.resize(nbins+3);
+	idx.cvar.resize(nbins+3);
+	double s = 0, v = 0;
+	idx.csum[0] = 0; idx.cvar[0] = 0;
+	for(int b = 0; b < nbins+2; b++) {
+		s += content[b];
+		v += var ? var[b] : (double)content[b];
+		idx.csum[b+1] = s;
+		idx.cvar[b+1] = v;
+	}
+}
+
+/*
+ * Class: SpectrumCache
+ * Brief:
+ *	Maps a key (e.g. "file.root|g11") to its window index, loading on
+ *	a miss and evicting the least recently used entries once the
+ *	indices take more than capacity bytes.
+ * Comments:
+ *	Entries are shared_ptrs, so an index handed out stays valid after
+ *	it is evicted. The most recent entry is never evicted, even if it
+ *	alone is over the cap. All calls are serialised by one mutex, the
+ *	loader included (ROOT I/O is not thread safe anyway).
+ */
+class SpectrumCache
+{
+public:
+	typedef std::shared_ptr<const window_index_t> index_ptr;
+	typedef std::function<bool(window_index_t&)> loader_t;
+
+	SpectrumCache(size_t capacity = 256u << 20) : _capacity(capacity), _bytes(0), _hits(0), _misses(0) { }
+
+public:
+	// Returns the index for key, calling load on a miss (NULL if it fails)
+	index_ptr get(const std::string& key, const loader_t& load);
+	bool contains(const std::string& key) const;
+	void setCapacity(size_t capacity);
+	void clear();
+
+	size_t capacity() const { return _capacity; }
+	size_t bytes()    const { return _bytes; }
+	size_t size()     const { std::lock_guard<std::mutex> lk(_m); return _map.size(); }
+	size_t hits()     const { return _hits; }
+	size_t misses()   const { return _misses; }
+
+private:
+	struct _entry_t
+	{
+		index_ptr idx;
+		std::list<std::string>::iterator lru;
+	};
+	void _evict();
+
+private:
+	mutable std::mutex _m;
+	std::list<std::string> _lru;    // front = most recently used
+	std::unordered_map<std::string, _entry_t> _map;
+	size_t _capacity;
+	size_t _bytes;
+	size_t _hits, _misses;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+SpectrumCache::index_ptr SpectrumCache::get(const std::string& key, const loader_t& load)
+{
+	std::lock_guard<std::mutex> lk(_m);
+	auto it = _map.find(key);
+	if( it != _map.end() ) {
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		_hits++;
+		return it->second.idx;
+	}
+	_misses++;
+	std::shared_ptr<window_index_t> idx(new window_index_t);
+	if( !load(*idx) ) return NULL;
+
+	_lru.push_front(key);
+	_map[key] = { idx, _lru.begin() };
+	_bytes += idx->bytes();
+	_evict();
+	return idx;
+}
+
+bool SpectrumCache::contains(const std::string& key) const
+{
+	std::lock_guard<std::mutex> lk(_m);
+	return _map.count(key) > 0;
+}
+
+void SpectrumCache::setCapacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> lk(_m);
+	_capacity = capacity;
+	_evict();
+}
+
+void SpectrumCache::clear()
+{
+	std::lock_guard<std::mutex> lk(_m);
+	_map.clear();
+	_lru.clear();
+	_bytes = 0;
+}
+
+// Drops entries from the back of the LRU list until under the cap (call locked)
+void SpectrumCache::_evict()
+{
+	while( _bytes > _capacity && _lru.size() > 1 ) {
+		auto it = _map.find( _lru.back() );
+		_bytes -= it->second.idx->bytes();
+		_map.erase(it);
+		_lru.pop_back();
+	}
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SPECTRUM_HIST_H
+#define SPECTRUM_HIST_H
+/***
+ * File: spectrum_hist.h
+ *
+ * Discription:
+ *	TH1F front end to the kernels in spectrum_math.h. The bin arrays
+ *	of the input histograms are handed to the kernels directly and the
+ *	result is written into a single new histogram, so adding runs,
+ *	normalising by live time and subtracting background needs no
+ *	Clone() and no GetBinContent / SetBinError loops.
+ **/
+#include <iostream>
+#include <vector>
+
+#include "TH1F.h"
+
+#include "spectrum_math.h"
+
+/*
+ * Func: fuse_hists
+ * Brief:
+ *	Returns a new histogram "name" holding
+ *	  sum_k w[k]*vh[k] - wb*hbkg
+ *	with the bin variances propagated (see spectrum_fuse).
+ * Comments:
+ *	Only bins [xlow, xhigh] are filled, xhigh < 0 means every bin
+ *	(including under/overflow). All inputs must have the binning of
+ *	vh[0]. hbkg may be NULL. buf is scratch space; pass the same one
+ *	for a whole loop of runs to keep memory flat.
+ */
+static inline TH1F* fuse_hists(const char* name, const std::vector<TH1F*>& vh, const std::vector<double>& w,
+                               TH1F* hbkg = NULL, double wb = 0, int xlow = 0, int xhigh = -1,
+                               spectrum_buffer_t* buf = NULL)
+{
+	if( vh.empty() || vh.size() != w.size() ) {
+		std::cout << "ERROR: FUSE_HISTS() EXPECTS EQUAL SIZED, NON EMPTY VECTORS!" << std::endl;
+		return NULL;
+	}
+	const int nbins = vh[0]->GetNbinsX();
+	const int ncells = nbins + 2;
+	std::vector<const float*>  vx;
+	std::vector<const double*> vvar;
+	for(size_t k = 0; k < vh.size(); k++) {
+		if( vh[k]->GetNbinsX() != nbins ) {
+			std::cout << "ERROR: FUSE_HISTS() " << vh[k]->GetName() << " HAS " << vh[k]->GetNbinsX() << " BINS, EXPECTED " << nbins << std::endl;
+			return NULL;
+		}
+		vx.push_back( vh[k]->GetArray() );
+		vvar.push_back( vh[k]->GetSumw2N() ? vh[k]->GetSumw2()->GetArray() : NULL );
+	}
+	const float*  bkg    = NULL;
+	const double* bkgvar = NULL;
+	if(hbkg) {
+		if( hbkg->GetNbinsX() != nbins ) {
+			std::cout << "ERROR: FUSE_HISTS() BACKGROUND " << hbkg->GetName() << " HAS " << hbkg->GetNbinsX() << " BINS, EXPECTED " << nbins << std::endl;
+			return NULL;
+		}
+		bkg    = hbkg->GetArray();
+		bkgvar = hbkg->GetSumw2N() ? hbkg->GetSumw2()->GetArray() : NULL;
+	}
+	if(xlow < 0) xlow = 0;
+	if(xhigh < 0 || xhigh > nbins+1) xhigh = nbins+1;
+
+	static thread_local spectrum_buffer_t scratch;
+	if(buf == NULL) buf = &scratch;
+	buf->resize(ncells);
+	spectrum_fuse<float>(vh.size(), vx.data(), vvar.data(), w.data(), bkg, bkgvar, wb,
+	                     xlow, xhigh, buf->content.data(), buf->var.data());
+
+	const TAxis* ax = vh[0]->GetXaxis();
+	TH1F* h = new TH1F(name, name, nbins, ax->GetXmin(), ax->GetXmax());
+	h->Sumw2();
+	float*  content = h->GetArray();
+	double* sumw2   = h->GetSumw2()->GetArray();
+	double  entries = 0;
+	for(int i = xlow; i <= xhigh; i++) {
+		content[i] = (float)buf->content[i];
+		sumw2[i]   = buf->var[i];
+	}
+	for(size_t k = 0; k < vh.size(); k++) entries += vh[k]->GetEntries();
+	h->SetEntries(entries);
+	h->GetXaxis()->SetTitle( ax->GetTitle() );
+	h->GetYaxis()->SetTitle( vh[0]->GetYaxis()->GetTitle() );
+	return h;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef SPECTRUM_MATH_H
+#define SPECTRUM_MATH_H
+/***
+ * File: spectrum_math.h
+ *
+ * Discription:
+ *	Kernels that work on contiguous spectrum buffers instead of
+ *	going bin by bin through the TH1 interface. Nothing in here
+ *	depends on ROOT.
+ *
+ *	Buffers follow the TH1 layout when they are handed to
+ *	TH1::SetContent / TH1::SetError, i.e. element 0 is the underflow
+ *	and element n+1 the overflow.
+ **/
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Func: poisson_kernel
+ * Brief:
+ *	content[i] = counts[i]
+ *	error[i]   = sqrt(counts[i])
+ *	for i in [0, n). Returns the sum of the counts.
+ * Comments:
+ *	Counts are non-negative, so the square root never needs the
+ *	errno / NaN slow path. With SSE2 two bins are done per sqrtpd.
+ */
+static inline double poisson_kernel(const int* counts, double* content, double* error, size_t n)
+{
+	size_t i = 0;
+	double total = 0;
+#ifdef __SSE2__
+	__m128d vtot = _mm_setzero_pd();
+	for( ; i + 2 <= n; i += 2 ) {
+		__m128i ci = _mm_loadl_epi64( (const __m128i*)(counts + i) );
+		__m128d cd = _mm_cvtepi32_pd(ci);
+		_mm_storeu_pd(content + i, cd);
+		_mm_storeu_pd(error   + i, _mm_sqrt_pd(cd));
+		vtot = _mm_add_pd(vtot, cd);
+	}
+	double tmp[2];
+	_mm_storeu_pd(tmp, vtot);
+	total = tmp[0] + tmp[1];
+#endif
+	for( ; i < n; i++ ) {
+		content[i] = counts[i];
+		error[i]   = std::sqrt( (double)counts[i] );
+		total     += counts[i];
+	}
+	return total;
+}
+
+/*
+ * Struct: spectrum_buffer_t
+ * Brief:
+ *	Output of the fused kernels: contents and variances of one
+ *	spectrum. Keep one around (or take one from a SpectrumBufferPool)
+ *	and reuse it, resize() only allocates when the spectrum grows.
+ */
+struct spectrum_buffer_t
+{
+	std::vector<double> content;
+	std::vector<double> var;
+	void resize(size_t n) { content.resize(n); var.resize(n); }
+	size_t size() const { return content.size(); }
+};
+
+/*
+ * Class: SpectrumBufferPool
+ * Brief:
+ *	Hands out spectrum buffers and takes them back, so processing many
+ *	runs reuses a handful of buffers instead of allocating per run.
+ */
+class SpectrumBufferPool
+{
+public:
+	std::unique_ptr<spectrum_buffer_t> acquire(size_t n)
+	{
+		std::unique_ptr<spectrum_buffer_t> b;
+		{
+			std::lock_guard<std::mutex> lk(_m);
+			if( !_free.empty() ) { b = std::move(_free.back()); _free.pop_back(); }
+		}
+		if( !b ) b.reset( new spectrum_buffer_t );
+		b->resize(n);
+		return b;
+	}
+	void release(std::unique_ptr<spectrum_buffer_t> b)
+	{
+		std::lock_guard<std::mutex> lk(_m);
+		_free.push_back( std::move(b) );
+	}
+private:
+	std::mutex _m;
+	std::vector<std::unique_ptr<spectrum_buffer_t>> _free;
+};
+
+/*
+ * Func: spectrum_fuse
+ * Brief:
+ *	One pass over bins [first, last] of
+ *	  out[i]    = sum_k w[k] * x_k[i]     - wb  * bkg[i]
+ *	  outvar[i] = sum_k w[k]^2 * var_k[i] + wb^2 * bkgvar[i]
+ *	which covers adding runs (w = 1), normalising by live time
+ *	(w = norm / t_k) and subtracting a background normalised the same
+ *	way (wb = norm / t_bkg), with the variances propagated.
+ * Comments:
+ *	x_k / bkg can be float (TH1F) or double (TH1D) arrays. A NULL
+ *	var_k or bkgvar means the input is raw counts (var = content).
+ *	bkg may be NULL (nothing subtracted). Bins outside [first, last]
+ *	are not touched. The bins are processed in cache sized blocks
+ *	with the run loop inside, so every inner loop is a plain
+ *	vectorisable multiply-add over contiguous memory.
+ */
+template<class T>
+static inline void spectrum_fuse(size_t nruns, const T* const* x, const double* const* var, const double* w,
+                                 const T* bkg, const double* bkgvar, double wb,
+                                 size_t first, size_t last, double* out, double* outvar)
+{
+	const size_t block = 512;
+	for(size_t b0 = first; b0 <= last; b0 += block) {
+		size_t b1 = (b0 + block - 1 < last) ? b0 + block - 1 : last;
+		double* o  = out + b0;
+		double* ov = outvar + b0;
+		size_t  n  = b1 - b0 + 1;
+		for(size_t i = 0; i < n; i++) { o[i] = 0; ov[i] = 0; }
+
+		for(size_t k = 0; k < nruns; k++) {
+			const T*      xk = x[k] + b0;
+			const double  wk = w[k], wk2 = w[k]*w[k];
+			if( var && var[k] ) {
+				const double* vk = var[k] + b0;
+				for(size_t i = 0; i < n; i++) { o[i] += wk*xk[i]; ov[i] += wk2*vk[i]; }
+			}
+			else {
+				for(size_t i = 0; i < n; i++) { o[i] += wk*xk[i]; ov[i] += wk2*xk[i]; }
+			}
+		}
+		if(bkg) {
+			const T*     xb  = bkg + b0;
+			const double wb2 = wb*wb;
+			if(bkgvar) {
+				const double* vb = bkgvar + b0;
+				for(size_t i = 0; i < n; i++) { o[i] -= wb*xb[i]; ov[i] += wb2*vb[i]; }
+			}
+			else {
+				for(size_t i = 0; i < n; i++) { o[i] -= wb*xb[i]; ov[i] += wb2*xb[i]; }
+			}
+		}
+	}
+}
+
+#endif
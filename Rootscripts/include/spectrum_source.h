@@ -0,0 +1,248 @@
+#ifndef SPECTRUM_SOURCE_H
+#define SPECTRUM_SOURCE_H
+/***
+ * File: spectrum_source.h
+ *
+ * Discription:
+ *	Lets the analysis macros take their spectra either from the
+ *	tagNNNX.root files written by make_rootfiles, or from a spectrum
+ *	archive written by make_spectrum_store. A source is
+ *
+ *	  ../Rootfiles/angular/tag040X.root   (ROOT file)
+ *	  ../Rootfiles/run.gss:040            (tag group 040 of an archive)
+ *
+ *	Files and archives are opened once and kept open, until a macro
+ *	done with a ROOT file calls close_spectrum_file. Fetching a
+ *	spectrum is timed as the parse stage (see stageprof.h).
+ *
+ *	get_spectrum_indices(...) instead returns prefix sum indices
+ *	(spectrum_cache.h) for window sums. They live in one memory capped
+ *	cache, and the ROOT file is only opened on a miss and closed again
+ *	right after.
+ **/
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "TFile.h"
+#include "TH1F.h"
+
+#include "subtags.h"
+#include "spectrum_store.h"
+#include "spectrum_cache.h"
+#include "stageprof.h"
+
+/*
+ * Func: split_store_source
+ * Brief:
+ *	"archive.gss:NNN" -> ("archive.gss", NNN). Returns false for
+ *	anything that is not an archive source.
+ */
+static inline bool split_store_source(const std::string& src, std::string& path, int& tag)
+{
+	size_t colon = src.rfind(':');
+	if( colon == std::string::npos || colon < 4 || src.compare(colon-4, 4, ".gss") != 0 ) return false;
+	path = src.substr(0, colon);
+	tag  = std::stoi( src.substr(colon+1) );
+	return true;
+}
+
+static inline SpectrumStore* open_spectrum_store(const std::string& path)
+{
+	static std::map<std::string, std::unique_ptr<SpectrumStore>> stores;
+	auto it = stores.find(path);
+	if( it != stores.end() ) return it->second.get();
+	SpectrumStore* s = new SpectrumStore(path.c_str());
+	stores[path].reset(s);
+	return s;
+}
+
+// The ROOT files opened by open_spectrum_file, by path
+static inline std::map<std::string, TFile*>& _spectrum_files()
+{
+	static std::map<std::string, TFile*> files;
+	return files;
+}
+
+static inline TFile* open_spectrum_file(const std::string& path)
+{
+	std::map<std::string, TFile*>& files = _spectrum_files();
+	auto it = files.find(path);
+	if( it != files.end() ) return it->second;
+	TFile* f = new TFile(path.c_str(), "READ");
+	files[path] = f;
+	return f;
+}
+
+/*
+ * Func: close_spectrum_file
+ * Brief:
+ *	Closes the ROOT file of source src if open_spectrum_file holds it.
+ *	Every histogram get_spectrum_hist returned from it is deleted with
+ *	it. Archive sources are left alone.
+ */
+static inline void close_spectrum_file(const std::string& src)
+{
+	std::map<std::string, TFile*>& files = _spectrum_files();
+	auto it = files.find(src);
+	if( it == files.end() ) return;
+	it->second->Close();
+	delete it->second;
+	files.erase(it);
+}
+
+/*
+ * Func: xy_spectrum_to_histo
+ * Brief:
+ *	Makes a Counts vs Channel histogram from a parsed xy spectrum.
+ *	Bin errors are the Poisson errors sqrt(counts).
+ * Comments:
+ *	Writes straight into the TH1F bin and Sumw2 arrays, so the
+ *	histogram is filled in a single pass over the channels.
+ *	The histogram is attached to the current directory.
+ */
+static inline TH1F* xy_spectrum_to_histo(const xy_spectrum_t& spec, const char* histoName = "HISTO")
+{
+	int min = spec.min, max = spec.max;
+	TH1F* h = new TH1F(histoName, histoName, max-min+1, min-.5, max+.5);
+	h->Sumw2();
+	// bin 0 is the underflow, so channel (min+i) lives in bin i+1
+	float*  content = h->GetArray();
+	double* sumw2   = h->GetSumw2()->GetArray();
+	const int* c    = spec.counts.data();
+	double total    = 0;
+	for(int i = 0; i < max-min+1; i++) {
+		content[i+1] = (float)c[i];
+		sumw2[i+1]   = (double)c[i];
+		total       += c[i];
+	}
+	h->SetEntries(total);
+	h->GetXaxis()->SetTitle("Channels");
+	h->GetYaxis()->SetTitle("Counts");
+	return h;
+}
+
+/*
+ * Func: get_spectrum_hist
+ * Brief:
+ *	Returns histogram hname ("gam1", "g11", ...) of source src, NULL
+ *	if it cannot be found.
+ * Comments:
+ *	Histograms from a ROOT file belong to that file. Histograms built
+ *	from an archive are not attached to any directory, belong to the
+ *	caller, and are named <hname>_<tag> so several tags can be used
+ *	side by side.
+ */
+static inline TH1F* get_spectrum_hist(const std::string& src, const std::string& hname)
+{
+	PROF_SCOPE(st_parse);
+	std::string path;
+	int tag;
+	if( !split_store_source(src, path, tag) ) {
+		Long64_t nread = TFile::GetFileBytesRead();
+		TFile* f = open_spectrum_file(src);
+		TH1F* h = f->IsZombie() ? NULL : (TH1F*)f->Get(hname.c_str());
+		if(h == NULL) std::cout << "No histogram " << hname << " in " << src << std::endl;
+		PROF_COUNT(st_parse, TFile::GetFileBytesRead() - nread, h != NULL);
+		return h;
+	}
+
+	SpectrumStore* store = open_spectrum_store(path);
+	int sub = subtag_from_str(hname.c_str());
+	xy_spectrum_t spec;
+	if( !store->isOpen() || sub < 0 || !store->get(tag, sub, spec) || spec.nlines == 0 ) {
+		std::cout << "No spectrum " << hname << " for tag " << tag << " in " << path << std::endl;
+		return NULL;
+	}
+	PROF_COUNT(st_parse, spec.counts.size()*sizeof(int), 1);
+	std::string name = hname + "_" + std::to_string(tag);
+	TH1F* h = xy_spectrum_to_histo(spec, name.c_str());
+	h->SetDirectory(0);
+	h->SetTitle(hname.c_str());
+	return h;
+}
+
+// The cache behind get_spectrum_indices(...)
+static inline SpectrumCache& spectrum_cache()
+{
+	static SpectrumCache cache;
+	return cache;
+}
+
+/*
+ * Func: _load_spectrum_index
+ * Brief:
+ *	Builds the window index of hname in src. For a ROOT file, f is
+ *	opened on first use and left open for the caller's next miss.
+ */
+static inline bool _load_spectrum_index(const std::string& src, const std::string& hname, std::unique_ptr<TFile>& f, window_index_t& idx)
+{
+	PROF_SCOPE(st_parse);
+	std::string path;
+	int tag;
+	if( !split_store_source(src, path, tag) ) {
+		Long64_t nread = TFile::GetFileBytesRead();
+		if( !f ) f.reset( new TFile(src.c_str(), "READ") );
+		TH1F* h = f->IsZombie() ? NULL : (TH1F*)f->Get(hname.c_str());
+		if(h == NULL) {
+			std::cout << "No histogram " << hname << " in " << src << std::endl;
+			return false;
+		}
+		const TAxis* ax = h->GetXaxis();
+		build_window_index<float>(idx, h->GetArray(), h->GetSumw2N() ? h->GetSumw2()->GetArray() : NULL,
+		                          h->GetNbinsX(), ax->GetXmin(), ax->GetXmax());
+		delete h;
+		PROF_COUNT(st_parse, TFile::GetFileBytesRead() - nread, 1);
+		return true;
+	}
+
+	SpectrumStore* store = open_spectrum_store(path);
+	int sub = subtag_from_str(hname.c_str());
+	xy_spectrum_t spec;
+	if( !store->isOpen() || sub < 0 || !store->get(tag, sub, spec) || spec.nlines == 0 ) {
+		std::cout << "No spectrum " << hname << " for tag " << tag << " in " << path << std::endl;
+		return false;
+	}
+	PROF_COUNT(st_parse, spec.counts.size()*sizeof(int), 1);
+	// Same binning as xy_spectrum_to_histo: channel (min+i) is bin i+1
+	int nbins = spec.max - spec.min + 1;
+	std::vector<int> cells(nbins+2, 0);
+	std::copy(spec.counts.begin(), spec.counts.begin() + nbins, cells.begin() + 1);
+	build_window_index<int>(idx, cells.data(), NULL, nbins, spec.min - .5, spec.max + .5);
+	return true;
+}
+
+/*
+ * Func: get_spectrum_indices
+ * Brief:
+ *	Window indices of the spectra vnames ("gam1", "g11", ...) of
+ *	source src, in order; an entry is NULL if the spectrum cannot be
+ *	found.
+ * Comments:
+ *	Asking for every spectrum a macro needs from a file in one call
+ *	opens that file at most once. Indices are cached under
+ *	"src|hname"; use spectrum_cache().setCapacity(bytes) to change the
+ *	memory cap.
+ */
+static inline std::vector<SpectrumCache::index_ptr> get_spectrum_indices(const std::string& src, const std::vector<std::string>& vnames)
+{
+	std::vector<SpectrumCache::index_ptr> vidx;
+	std::unique_ptr<TFile> f; // opened on the first miss, closed on return
+	for(auto it = vnames.begin(); it != vnames.end(); it++) {
+		const std::string& hname = *it;
+		vidx.push_back( spectrum_cache().get(src + "|" + hname, [&](window_index_t& idx) {
+			return _load_spectrum_index(src, hname, f, idx);
+		} ) );
+	}
+	return vidx;
+}
+
+static inline SpectrumCache::index_ptr get_spectrum_index(const std::string& src, const std::string& hname)
+{
+	return get_spectrum_indices(src, { hname })[0];
+}
+
+#endif
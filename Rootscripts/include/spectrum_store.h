@@ -0,0 +1,371 @@
+#ifndef SPECTRUM_STORE_H
+#define SPECTRUM_STORE_H
+/***
+ * File: spectrum_store.h
+ *
+ * Discription:
+ *	Compact binary archive (.gss) for the MCA spectra of a whole run.
+ *	Each spectrum is stored as runs of non-zero channels, so the mostly
+ *	empty 65536 channel spectra shrink to a few kB. A dense index keyed
+ *	by (tag, subtag) sits in front of the data, and the file is read by
+ *	memory mapping it, so pulling out one spectrum is a table lookup
+ *	plus a decode of that spectrum only.
+ *
+ *	tag is the tag group number (040 for tag0400.xy ... tag0409.xy),
+ *	subtag the last digit (see subtags.h). key = tag*10 + subtag, which
+ *	is just the number in the .xy file name.
+ *
+ * Layout (little endian, every offset is from the start of the file):
+ *	gss_header_t
+ *	uint32_t slots[key_max - key_min + 1]   // entry index or GSS_NO_ENTRY
+ *	gss_entry_t entries[nspectra]
+ *	data: per spectrum, nruns x { uint32 start, uint32 len, int32 counts[len] }
+ *	      start is relative to the entry's min channel
+ **/
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xytools.h"
+
+#define GSS_MAGIC    "GSPECST1"
+#define GSS_VERSION  1
+#define GSS_NO_ENTRY 0xFFFFFFFFu
+
+struct gss_header_t
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t nspectra;
+	int32_t  key_min;
+	int32_t  key_max;
+	uint64_t slots_offset;
+	uint64_t entries_offset;
+	uint64_t data_offset;
+	uint64_t file_size;
+};
+
+struct gss_entry_t
+{
+	int32_t  key;         // tag*10 + subtag
+	int32_t  min_chan;    // channel of element 0
+	int32_t  nchan;       // number of channels (zeros included)
+	uint32_t nruns;       // number of non-zero runs
+	uint64_t data_offset; // first run header
+	uint64_t data_bytes;  // size of the encoded runs
+	double   total;       // sum of all counts
+	uint64_t reserved;
+};
+
+static inline int gss_key(int tag, int sub) { return tag*10 + sub; }
+
+
+/*
+ * Class: SpectrumStoreWriter
+ * Brief:
+ *	Collects spectra in memory (already run length encoded) and
+ *	writes the archive in one go.
+ */
+class SpectrumStoreWriter
+{
+public:
+	// Returns false if the key is already present
+	bool add(int tag, int sub, const xy_spectrum_t& spec);
+	bool add(int tag, int sub, int min_chan, const int* counts, int nchan);
+	bool has(int tag, int sub) const;
+	// True if (tag, sub) is present and holds exactly spec
+	bool same(int tag, int sub, const xy_spectrum_t& spec) const;
+	size_t size() const { return _entries.size(); }
+	bool write(const char* fname) const;
+
+private:
+	static void _encode(const int* counts, int nchan, std::vector<uint32_t>& block, gss_entry_t& e);
+
+private:
+	std::vector<gss_entry_t> _entries;
+	std::vector<std::vector<uint32_t>> _blocks;
+};
+
+/*
+ * Class: SpectrumStore
+ * Brief:
+ *	Read only view of a .gss archive. The file stays mapped for the
+ *	lifetime of the object. open() rejects archives whose tables or
+ *	data point outside the file.
+ */
+class SpectrumStore
+{
+public:
+	SpectrumStore() : _map(NULL), _size(0), _hdr(NULL), _slots(NULL), _entries(NULL) { }
+	SpectrumStore(const char* fname) : SpectrumStore() { open(fname); }
+	~SpectrumStore() { close(); }
+	SpectrumStore(const SpectrumStore&) = delete;
+	SpectrumStore& operator=(const SpectrumStore&) = delete;
+
+public:
+	bool open(const char* fname);
+	void close();
+	bool isOpen() const { return _map != NULL; }
+
+	// O(1) lookup, NULL if the spectrum is not in the archive
+	const gss_entry_t* find(int tag, int sub) const;
+	size_t size() const { return _hdr ? _hdr->nspectra : 0; }
+	const gss_entry_t& entry(size_t i) const { return _entries[i]; }
+
+	// Expand one spectrum into a dense counts array
+	bool decode(const gss_entry_t* e, xy_spectrum_t& spec) const;
+	bool get(int tag, int sub, xy_spectrum_t& spec) const { return decode(find(tag, sub), spec); }
+
+private:
+	const char* _check_layout() const;
+
+private:
+	void*   _map;
+	size_t  _size;
+	const gss_header_t* _hdr;
+	const uint32_t*     _slots;
+	const gss_entry_t*  _entries;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+bool SpectrumStoreWriter::has(int tag, int sub) const
+{
+	int key = gss_key(tag, sub);
+	for( auto it = _entries.begin(); it != _entries.end(); it++ )
+		if( it->key == key ) return true;
+	return false;
+}
+
+bool SpectrumStoreWriter::same(int tag, int sub, const xy_spectrum_t& spec) const
+{
+	int key = gss_key(tag, sub);
+	for( size_t i = 0; i < _entries.size(); i++ ) {
+		if( _entries[i].key != key ) continue;
+		if( _entries[i].min_chan != spec.min || _entries[i].nchan != (int)spec.counts.size() ) return false;
+		gss_entry_t e;
+		std::memset(&e, 0, sizeof(e));
+		std::vector<uint32_t> block;
+		_encode(spec.counts.data(), (int)spec.counts.size(), block, e);
+		return block == _blocks[i];
+	}
+	return false;
+}
+
+bool SpectrumStoreWriter::add(int tag, int sub, const xy_spectrum_t& spec)
+{
+	return add(tag, sub, spec.min, spec.counts.data(), (int)spec.counts.size());
+}
+
+/*
+ * Func: add
+ * Brief:
+ *	Encodes counts[0 .. nchan) (channel min_chan + i) as runs of non
+ *	zero channels.
+ */
+bool SpectrumStoreWriter::add(int tag, int sub, int min_chan, const int* counts, int nchan)
+{
+	if( has(tag, sub) ) return false;
+
+	gss_entry_t e;
+	std::memset(&e, 0, sizeof(e));
+	e.key      = gss_key(tag, sub);
+	e.min_chan = min_chan;
+	e.nchan    = nchan;
+
+	std::vector<uint32_t> block;
+	_encode(counts, nchan, block, e);
+	_entries.push_back(e);
+	_blocks.push_back( std::move(block) );
+	return true;
+}
+
+// Runs of non zero channels: start, length, counts...; fills e.total, e.nruns, e.data_bytes
+void SpectrumStoreWriter::_encode(const int* counts, int nchan, std::vector<uint32_t>& block, gss_entry_t& e)
+{
+	int i = 0;
+	while( i < nchan ) {
+		while( i < nchan && counts[i] == 0 ) i++;
+		if( i == nchan ) break;
+		int start = i;
+		while( i < nchan && counts[i] != 0 ) i++;
+		block.push_back( (uint32_t)start );
+		block.push_back( (uint32_t)(i - start) );
+		for( int k = start; k < i; k++ ) {
+			block.push_back( (uint32_t)counts[k] );
+			e.total += counts[k];
+		}
+		e.nruns++;
+	}
+	e.data_bytes = block.size() * sizeof(uint32_t);
+}
+
+bool SpectrumStoreWriter::write(const char* fname) const
+{
+	gss_header_t h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, GSS_MAGIC, 8);
+	h.version  = GSS_VERSION;
+	h.nspectra = (uint32_t)_entries.size();
+	h.key_min  = 0;
+	h.key_max  = -1;
+	for( size_t i = 0; i < _entries.size(); i++ ) {
+		if( i == 0 || _entries[i].key < h.key_min ) h.key_min = _entries[i].key;
+		if( i == 0 || _entries[i].key > h.key_max ) h.key_max = _entries[i].key;
+	}
+	size_t nslots = (size_t)(h.key_max - h.key_min + 1);
+	std::vector<uint32_t> slots(nslots, GSS_NO_ENTRY);
+	for( size_t i = 0; i < _entries.size(); i++ )
+		slots[ _entries[i].key - h.key_min ] = (uint32_t)i;
+
+	// Keep everything 8 byte aligned
+	auto align8 = [](uint64_t x) { return (x + 7) & ~(uint64_t)7; };
+	h.slots_offset   = sizeof(gss_header_t);
+	h.entries_offset = align8( h.slots_offset + nslots*sizeof(uint32_t) );
+	h.data_offset    = h.entries_offset + _entries.size()*sizeof(gss_entry_t);
+
+	std::vector<gss_entry_t> entries = _entries;
+	uint64_t off = h.data_offset;
+	for( size_t i = 0; i < entries.size(); i++ ) {
+		entries[i].data_offset = off;
+		off += entries[i].data_bytes;
+	}
+	h.file_size = off;
+
+	FILE* f = std::fopen(fname, "wb");
+	if( f == NULL ) {
+		std::fprintf(stderr, "SpectrumStoreWriter::write(): cannot create %s\n", fname);
+		return false;
+	}
+	static const char pad[8] = { 0 };
+	bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+	ok = ok && std::fwrite(slots.data(), sizeof(uint32_t), nslots, f) == nslots;
+	size_t npad = h.entries_offset - (h.slots_offset + nslots*sizeof(uint32_t));
+	ok = ok && std::fwrite(pad, 1, npad, f) == npad;
+	ok = ok && std::fwrite(entries.data(), sizeof(gss_entry_t), entries.size(), f) == entries.size();
+	for( size_t i = 0; ok && i < _blocks.size(); i++ )
+		ok = std::fwrite(_blocks[i].data(), sizeof(uint32_t), _blocks[i].size(), f) == _blocks[i].size();
+	ok = (std::fclose(f) == 0) && ok;
+	if( !ok ) std::fprintf(stderr, "SpectrumStoreWriter::write(): error writing %s\n", fname);
+	return ok;
+}
+
+
+bool SpectrumStore::open(const char* fname)
+{
+	close();
+	int fd = ::open(fname, O_RDONLY);
+	if( fd < 0 ) {
+		std::fprintf(stderr, "SpectrumStore::open(): cannot open %s\n", fname);
+		return false;
+	}
+	struct stat st;
+	if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(gss_header_t) ) {
+		std::fprintf(stderr, "SpectrumStore::open(): %s is not a spectrum store\n", fname);
+		::close(fd);
+		return false;
+	}
+	_size = (size_t)st.st_size;
+	_map  = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if( _map == MAP_FAILED ) {
+		std::fprintf(stderr, "SpectrumStore::open(): cannot mmap %s\n", fname);
+		_map = NULL; _size = 0;
+		return false;
+	}
+	const char* base = (const char*)_map;
+	_hdr = (const gss_header_t*)base;
+	if( std::memcmp(_hdr->magic, GSS_MAGIC, 8) != 0 || _hdr->version != GSS_VERSION || _hdr->file_size != _size ) {
+		std::fprintf(stderr, "SpectrumStore::open(): %s is not a (version %d) spectrum store\n", fname, GSS_VERSION);
+		close();
+		return false;
+	}
+	// Every offset in the file is checked once here, so find and
+	// decode never read outside the mapping
+	const char* bad = _check_layout();
+	if( bad ) {
+		std::fprintf(stderr, "SpectrumStore::open(): %s is corrupt (%s)\n", fname, bad);
+		close();
+		return false;
+	}
+	_slots   = (const uint32_t*)(base + _hdr->slots_offset);
+	_entries = (const gss_entry_t*)(base + _hdr->entries_offset);
+	return true;
+}
+
+// NULL if the slot table, the entries and every entry's data lie inside
+// the file, otherwise what is wrong
+const char* SpectrumStore::_check_layout() const
+{
+	const char* base = (const char*)_map;
+	// [off, off + len) inside the file, without overflowing
+	auto inside = [this](uint64_t off, uint64_t len) { return off <= _size && len <= _size - off; };
+
+	if( (int64_t)_hdr->key_max - _hdr->key_min < -1 ) return "key range";
+	uint64_t nslots = (uint64_t)( (int64_t)_hdr->key_max - _hdr->key_min + 1 );
+	if( _hdr->slots_offset < sizeof(gss_header_t) || _hdr->slots_offset % sizeof(uint32_t) != 0 ||
+	    !inside(_hdr->slots_offset, nslots*sizeof(uint32_t)) ) return "slot table";
+	if( _hdr->entries_offset % 8 != 0 || !inside(_hdr->entries_offset, (uint64_t)_hdr->nspectra*sizeof(gss_entry_t)) ) return "entry table";
+
+	const uint32_t*    slots   = (const uint32_t*)(base + _hdr->slots_offset);
+	const gss_entry_t* entries = (const gss_entry_t*)(base + _hdr->entries_offset);
+	for( uint64_t k = 0; k < nslots; k++ )
+		if( slots[k] != GSS_NO_ENTRY && slots[k] >= _hdr->nspectra ) return "slot index";
+	for( uint32_t i = 0; i < _hdr->nspectra; i++ ) {
+		const gss_entry_t& e = entries[i];
+		if( e.nchan < 0 || e.nchan > XY_MAX_CHANNEL + 1 ) return "channel count";
+		if( e.data_offset % sizeof(uint32_t) != 0 || e.data_bytes % sizeof(uint32_t) != 0 ||
+		    !inside(e.data_offset, e.data_bytes) ) return "spectrum data";
+	}
+	return NULL;
+}
+
+void SpectrumStore::close()
+{
+	if( _map ) munmap(_map, _size);
+	_map = NULL; _size = 0;
+	_hdr = NULL; _slots = NULL; _entries = NULL;
+}
+
+const gss_entry_t* SpectrumStore::find(int tag, int sub) const
+{
+	if( !_hdr || sub < 0 || sub > 9 ) return NULL;
+	int key = gss_key(tag, sub);
+	if( key < _hdr->key_min || key > _hdr->key_max ) return NULL;
+	uint32_t i = _slots[ key - _hdr->key_min ];
+	if( i == GSS_NO_ENTRY || i >= _hdr->nspectra ) return NULL;
+	return &_entries[i];
+}
+
+bool SpectrumStore::decode(const gss_entry_t* e, xy_spectrum_t& spec) const
+{
+	if( e == NULL ) return false;
+	spec.counts.assign( e->nchan, 0 );
+	spec.min    = e->min_chan;
+	spec.max    = e->min_chan + e->nchan - 1;
+	spec.nlines = e->nchan;
+	spec.nbytes = e->data_bytes;
+
+	const uint32_t* p   = (const uint32_t*)( (const char*)_map + e->data_offset );
+	const uint32_t* end = p + e->data_bytes / sizeof(uint32_t);
+	for( uint32_t r = 0; r < e->nruns; r++ ) {
+		if( p + 2 > end ) return false;
+		uint32_t start = p[0], len = p[1];
+		p += 2;
+		if( p + len > end || (uint64_t)start + len > (uint64_t)e->nchan ) return false;
+		std::memcpy( spec.counts.data() + start, p, len*sizeof(uint32_t) );
+		p += len;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef STAGEPROF_H
+#define STAGEPROF_H
+/***
+ * File: stageprof.h
+ *
+ * Discription:
+ *	Per stage timers and counters for the analysis chain. Every macro
+ *	brackets its work with
+ *
+ *	  PROF_BEGIN("make_rootfiles");     // reset, start the run clock
+ *	  { PROF_SCOPE(st_parse); ... }     // time a block
+ *	  PROF_COUNT(st_parse, nbytes, 1);  // bytes / spectra handled
+ *	  PROF_REPORT();                    // summary + report file
+ *
+ *	PROF_REPORT() prints a table and, if the environment variable
+ *	GSPEC_PROF names a file, appends the run to it (JSON Lines, one
+ *	object per run, if the name ends in .json or .jsonl, CSV
+ *	otherwise). PROF_REPORT_TO(path) writes to path instead.
+ *
+ *	Compiling with -DGSPEC_NO_PROF turns every PROF_* macro into a
+ *	no-op, e.g. for ACLiC
+ *	  gSystem->AddIncludePath("-DGSPEC_NO_PROF");
+ *
+ * Comments:
+ *	Counters are atomics, so scopes may be opened from worker threads;
+ *	stage times are then summed over threads and can exceed the run
+ *	wall time. Peak memory is the peak resident set size of the
+ *	process (getrusage), sampled at the end of every scope.
+ *	Nothing here depends on ROOT.
+ **/
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/resource.h>
+
+// parse -- reading input spectra (.xy files, ROOT files, archives)
+// histo -- building histograms from parsed counts
+// bkg   -- adding, normalising and background subtracting spectra
+// fit   -- peak extraction (fits and window sums)
+// write -- writing results (ROOT files, CSV)
+enum prof_stage { st_parse = 0, st_histo = 1, st_bkg = 2, st_fit = 3, st_write = 4, ST_NSTAGES = 5 };
+
+static const char* _prof_stage_names[ST_NSTAGES] = { "parse", "histo", "bkg", "fit", "write" };
+
+struct prof_stage_t
+{
+	std::atomic<uint64_t> ns;       // time spent inside the stage
+	std::atomic<uint64_t> calls;    // closed scopes
+	std::atomic<uint64_t> bytes;    // bytes read (parse) or written (write)
+	std::atomic<uint64_t> spectra;  // spectra handled
+	std::atomic<long>     rss_kb;   // peak RSS seen at the end of a scope
+};
+
+// Peak resident set size of the process in kB
+static inline long prof_peak_rss_kb()
+{
+	struct rusage ru;
+	if( getrusage(RUSAGE_SELF, &ru) != 0 ) return 0;
+	return ru.ru_maxrss; // kB on Linux
+}
+
+/*
+ * Class: StageProf
+ * Brief:
+ *	Process wide set of stage counters, see the PROF_* macros.
+ */
+class StageProf
+{
+public:
+	static StageProf& get() { static StageProf p; return p; }
+
+public:
+	void begin(const char* run);
+	void add(int stage, uint64_t ns);
+	void count(int stage, uint64_t bytes, uint64_t spectra);
+	bool report(const char* path = NULL) const;
+
+	const prof_stage_t& stage(int st) const { return _st[st]; }
+	double wall() const;
+
+private:
+	StageProf() { begin("run"); }
+	bool _write_json(FILE* f) const;
+	bool _write_csv(FILE* f, bool header) const;
+
+private:
+	std::string _run;
+	std::chrono::steady_clock::time_point _t0;
+	prof_stage_t _st[ST_NSTAGES];
+};
+
+// Times the enclosing block as one call of stage st
+class ProfScope
+{
+public:
+	ProfScope(int st) : _st(st), _t0(std::chrono::steady_clock::now()) { }
+	~ProfScope()
+	{
+		auto dt = std::chrono::steady_clock::now() - _t0;
+		StageProf::get().add(_st, std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count());
+	}
+	ProfScope(const ProfScope&) = delete;
+	ProfScope& operator=(const ProfScope&) = delete;
+private:
+	int _st;
+	std::chrono::steady_clock::time_point _t0;
+};
+
+#define _PROF_CAT2(a, b) a##b
+#define _PROF_CAT(a, b)  _PROF_CAT2(a, b)
+#ifndef GSPEC_NO_PROF
+#define PROF_BEGIN(run)              StageProf::get().begin(run)
+#define PROF_SCOPE(st)               ProfScope _PROF_CAT(_prof_scope_, __LINE__)(st)
+#define PROF_COUNT(st, bytes, nspec) StageProf::get().count(st, bytes, nspec)
+#define PROF_REPORT()                StageProf::get().report()
+#define PROF_REPORT_TO(path)         StageProf::get().report(path)
+#else
+#define PROF_BEGIN(run)              ((void)0)
+#define PROF_SCOPE(st)               ((void)0)
+#define PROF_COUNT(st, bytes, nspec) ((void)0)
+#define PROF_REPORT()                ((void)0)
+#define PROF_REPORT_TO(path)         ((void)0)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+void StageProf::begin(const char* run)
+{
+	_run = run;
+	for(int i = 0; i < ST_NSTAGES; i++) {
+		_st[i].ns = 0; _st[i].calls = 0; _st[i].bytes = 0; _st[i].spectra = 0; _st[i].rss_kb = 0;
+	}
+	_t0 = std::chrono::steady_clock::now();
+}
+
+void StageProf::add(int stage, uint64_t ns)
+{
+	prof_stage_t& s = _st[stage];
+	s.ns    += ns;
+	s.calls += 1;
+	long rss = prof_peak_rss_kb();
+	long old = s.rss_kb;
+	while( rss > old && !s.rss_kb.compare_exchange_weak(old, rss) ) { }
+}
+
+void StageProf::count(int stage, uint64_t bytes, uint64_t spectra)
+{
+	_st[stage].bytes   += bytes;
+	_st[stage].spectra += spectra;
+}
+
+double StageProf::wall() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - _t0).count();
+}
+
+static inline double _prof_rate(double n, double t) { return t > 0 ? n/t : 0; }
+
+bool StageProf::_write_json(FILE* f) const
+{
+	double wall = this->wall();
+	uint64_t nbytes = _st[st_parse].bytes, nspec = _st[st_parse].spectra;
+	std::fprintf(f, "{\"run\": \"%s\", \"wall_s\": %.6f, \"bytes_read\": %llu, \"spectra\": %llu, "
+	                "\"spectra_per_s\": %.1f, \"peak_rss_kb\": %ld, \"stages\": [",
+	             _run.c_str(), wall, (unsigned long long)nbytes, (unsigned long long)nspec,
+	             _prof_rate(nspec, wall), prof_peak_rss_kb());
+	for(int i = 0; i < ST_NSTAGES; i++) {
+		const prof_stage_t& s = _st[i];
+		double t = s.ns*1e-9;
+		std::fprintf(f, "%s{\"stage\": \"%s\", \"wall_s\": %.6f, \"calls\": %llu, \"bytes\": %llu, "
+		                "\"spectra\": %llu, \"spectra_per_s\": %.1f, \"MB_per_s\": %.3f, \"peak_rss_kb\": %ld}",
+		             i ? ", " : "", _prof_stage_names[i], t, (unsigned long long)s.calls.load(),
+		             (unsigned long long)s.bytes.load(), (unsigned long long)s.spectra.load(),
+		             _prof_rate(s.spectra, t), _prof_rate(s.bytes*1e-6, t), s.rss_kb.load());
+	}
+	std::fprintf(f, "]}\n");
+	return !std::ferror(f);
+}
+
+bool StageProf::_write_csv(FILE* f, bool header) const
+{
+	if(header) std::fprintf(f, "run,stage,wall_s,calls,bytes,spectra,spectra_per_s,MB_per_s,peak_rss_kb\n");
+	double wall = this->wall();
+	for(int i = 0; i < ST_NSTAGES; i++) {
+		const prof_stage_t& s = _st[i];
+		double t = s.ns*1e-9;
+		std::fprintf(f, "%s,%s,%.6f,%llu,%llu,%llu,%.1f,%.3f,%ld\n", _run.c_str(), _prof_stage_names[i], t,
+		             (unsigned long long)s.calls.load(), (unsigned long long)s.bytes.load(),
+		             (unsigned long long)s.spectra.load(), _prof_rate(s.spectra, t),
+		             _prof_rate(s.bytes*1e-6, t), s.rss_kb.load());
+	}
+	uint64_t nbytes = _st[st_parse].bytes, nspec = _st[st_parse].spectra;
+	std::fprintf(f, "%s,total,%.6f,1,%llu,%llu,%.1f,%.3f,%ld\n", _run.c_str(), wall,
+	             (unsigned long long)nbytes, (unsigned long long)nspec,
+	             _prof_rate(nspec, wall), _prof_rate(nbytes*1e-6, wall), prof_peak_rss_kb());
+	return !std::ferror(f);
+}
+
+/*
+ * Func: report
+ * Brief:
+ *	Prints the per stage table and appends the run to path (or to
+ *	$GSPEC_PROF when path is NULL). Returns false if the report file
+ *	cannot be written.
+ * Comments:
+ *	Every run appends one JSON object on a single line (so several
+ *	runs make a valid JSON Lines file) or one CSV block; a CSV file
+ *	gets its header only when it is new or empty.
+ */
+bool StageProf::report(const char* path) const
+{
+	double wall = this->wall();
+	std::printf("%-16s %10s %8s %12s %10s %12s %10s\n", _run.c_str(), "wall [s]", "calls", "MB", "spectra", "spectra/s", "RSS [MB]");
+	for(int i = 0; i < ST_NSTAGES; i++) {
+		const prof_stage_t& s = _st[i];
+		if(s.calls == 0 && s.spectra == 0) continue;
+		double t = s.ns*1e-9;
+		std::printf("  %-14s %10.4f %8llu %12.3f %10llu %12.1f %10.1f\n", _prof_stage_names[i], t,
+		            (unsigned long long)s.calls.load(), s.bytes*1e-6, (unsigned long long)s.spectra.load(),
+		            _prof_rate(s.spectra, t), s.rss_kb/1024.0);
+	}
+	std::printf("  %-14s %10.4f %8s %12.3f %10llu %12.1f %10.1f\n", "total", wall, "",
+	            _st[st_parse].bytes*1e-6, (unsigned long long)_st[st_parse].spectra.load(),
+	            _prof_rate(_st[st_parse].spectra, wall), prof_peak_rss_kb()/1024.0);
+
+	if(path == NULL) path = std::getenv("GSPEC_PROF");
+	if(path == NULL || path[0] == '\0') return true;
+	FILE* f = std::fopen(path, "a");
+	if(f == NULL) {
+		std::fprintf(stderr, "StageProf::report(): cannot write %s\n", path);
+		return false;
+	}
+	size_t len = std::strlen(path);
+	bool json  = ( len >= 5 && std::strcmp(path + len - 5, ".json")  == 0 )
+	          || ( len >= 6 && std::strcmp(path + len - 6, ".jsonl") == 0 );
+	std::fseek(f, 0, SEEK_END);
+	bool ok    = json ? _write_json(f) : _write_csv(f, std::ftell(f) == 0);
+	std::fclose(f);
+	if(!ok) std::fprintf(stderr, "StageProf::report(): error writing %s\n", path);
+	return ok;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SUBTAGS_H
+#define SUBTAGS_H
+/***
+ * File: subtags.h
+ *
+ * Discription:
+ *	Every tag group is ten consecutive tagNNN0.xy ... tagNNN9.xy files,
+ *	the last digit says which spectrum the file holds.
+ **/
+#include <cstring>
+
+enum subtag { gam1 = 0, gam2 = 1, gtac = 2, g1_t = 3, g2_t = 4, g1_g2 = 5, g11 = 6, g21 = 7, g12 = 8, g22 = 9 };
+
+static const char* _subtag_names[10] = { "gam1", "gam2", "gtac", "g1_t", "g2_t", "g1_g2", "g11", "g21", "g12", "g22" };
+
+// Name of subtag n ("UNKNOWN" if out of range)
+static inline const char* subtag_name(int n)
+{
+	if( n < 0 || n > 9 ) return "UNKNOWN";
+	return _subtag_names[n];
+}
+
+// Subtag of a spectrum name (-1 if unknown)
+static inline int subtag_from_str(const char* s)
+{
+	for( int i = 0; i < 10; i++ )
+		if( std::strcmp(s, _subtag_names[i]) == 0 ) return i;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+/***
+ * File: workpool.h
+ *
+ * Discription:
+ *	Small work-stealing thread pool. Every worker owns a deque of
+ *	jobs; it takes new work from the back of its own deque and, when
+ *	that is empty, steals from the front of the other workers' deques.
+ *	Jobs submitted from inside a job go onto the submitting worker's
+ *	deque so nested work stays local.
+ *
+ * Usage:
+ *	WorkPool pool(nthreads);      // 0 -> std::thread::hardware_concurrency()
+ *	pool.submit( [&]{ ... } );
+ *	pool.wait();                  // blocks until every job has finished
+ **/
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool
+{
+public:
+	WorkPool(unsigned nthreads = 0);
+	~WorkPool();
+	WorkPool(const WorkPool&) = delete;
+	WorkPool& operator=(const WorkPool&) = delete;
+
+public:
+	void submit(std::function<void()> job);
+	void wait();
+	unsigned size() const;
+
+private:
+	struct _queue_t
+	{
+		std::mutex m;
+		std::deque<std::function<void()>> q;
+	};
+	void _worker(unsigned id);
+	bool _try_pop(unsigned id, std::function<void()>& job);
+
+private:
+	std::vector<std::unique_ptr<_queue_t>> _queues;
+	std::vector<std::thread> _threads;
+	std::atomic<size_t>   _queued;   // jobs sitting in a deque
+	std::atomic<size_t>   _pending;  // jobs submitted but not finished
+	std::atomic<unsigned> _next;     // round robin for external submits
+	bool _stop;
+	std::mutex _wake_m;
+	std::condition_variable _wake_cv;
+	std::condition_variable _done_cv;
+
+	// Which pool/worker the current thread belongs to (if any)
+	static thread_local WorkPool* _tl_pool;
+	static thread_local unsigned  _tl_id;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+thread_local WorkPool* WorkPool::_tl_pool = nullptr;
+thread_local unsigned  WorkPool::_tl_id   = 0;
+
+WorkPool::WorkPool(unsigned nthreads) : _queued(0), _pending(0), _next(0), _stop(false)
+{
+	if(nthreads == 0) nthreads = std::thread::hardware_concurrency();
+	if(nthreads == 0) nthreads = 1;
+	for(unsigned i = 0; i < nthreads; i++)
+		_queues.emplace_back( new _queue_t );
+	for(unsigned i = 0; i < nthreads; i++)
+		_threads.emplace_back( &WorkPool::_worker, this, i );
+}
+
+WorkPool::~WorkPool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> lk(_wake_m);
+		_stop = true;
+	}
+	_wake_cv.notify_all();
+	for(auto it = _threads.begin(); it != _threads.end(); it++)
+		it->join();
+}
+
+unsigned WorkPool::size() const
+{
+	return _threads.size();
+}
+
+/*
+ * Func: submit
+ * Brief:
+ *	Queues a job. From a worker of this pool the job goes onto that
+ *	worker's own deque, otherwise the deques are filled round robin.
+ */
+void WorkPool::submit(std::function<void()> job)
+{
+	unsigned id;
+	if(_tl_pool == this) id = _tl_id;
+	else                 id = _next++ % _queues.size();
+
+	_pending++;
+	{
+		std::lock_guard<std::mutex> lk(_queues[id]->m);
+		_queues[id]->q.push_back( std::move(job) );
+	}
+	{
+		// Increment under the lock so a worker about to sleep sees it
+		std::lock_guard<std::mutex> lk(_wake_m);
+		_queued++;
+	}
+	_wake_cv.notify_one();
+}
+
+/*
+ * Func: wait
+ * Brief:
+ *	Blocks until every submitted job (including jobs submitted by
+ *	other jobs) has finished.
+ * Comments:
+ *	Must not be called from inside a job.
+ */
+void WorkPool::wait()
+{
+	std::unique_lock<std::mutex> lk(_wake_m);
+	_done_cv.wait(lk, [this]{ return _pending == 0; });
+}
+
+bool WorkPool::_try_pop(unsigned id, std::function<void()>& job)
+{
+	// Own deque first (LIFO, cache warm)
+	{
+		std::lock_guard<std::mutex> lk(_queues[id]->m);
+		if( !_queues[id]->q.empty() ) {
+			job = std::move( _queues[id]->q.back() );
+			_queues[id]->q.pop_back();
+			return true;
+		}
+	}
+	// Then steal from the others (FIFO, oldest work first)
+	for(unsigned k = 1; k < _queues.size(); k++) {
+		_queue_t& victim = *_queues[ (id + k) % _queues.size() ];
+		std::lock_guard<std::mutex> lk(victim.m);
+		if( !victim.q.empty() ) {
+			job = std::move( victim.q.front() );
+			victim.q.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkPool::_worker(unsigned id)
+{
+	_tl_pool = this;
+	_tl_id   = id;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lk(_wake_m);
+			_wake_cv.wait(lk, [this]{ return _stop || _queued > 0; });
+			if(_stop && _queued == 0) return;
+		}
+		std::function<void()> job;
+		if( !_try_pop(id, job) ) continue; // someone else got there first
+		_queued--;
+		try {
+			job();
+		}
+		catch(const std::exception& e) {
+			std::cerr << "WorkPool: job threw: " << e.what() << std::endl;
+		}
+		catch(...) {
+			std::cerr << "WorkPool: job threw an unknown exception" << std::endl;
+		}
+		if( --_pending == 0 ) {
+			std::lock_guard<std::mutex> lk(_wake_m);
+			_done_cv.notify_all();
+		}
+	}
+}
+
+#endif
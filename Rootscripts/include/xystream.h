@@ -0,0 +1,583 @@
+#ifndef XYSTREAM_H
+#define XYSTREAM_H
+/***
+ * File: xystream.h
+ *
+ * Discription:
+ *	Live analysis of .xy files while the MCA is still writing them.
+ *
+ *	XYTail         keeps the counts of one tagNNNN.xy file up to date.
+ *	               Appended "chan counts" lines are read as deltas (a
+ *	               channel that shows up again is summed, as in
+ *	               parse_xy_buffer). A file that is truncated, replaced
+ *	               or rewritten in place is re-read and diffed against
+ *	               what was there before.
+ *	XYWatcher      reports which tagNNNN.xy files of a directory changed,
+ *	               with inotify, or by polling stat() if inotify is not
+ *	               available (e.g. network file systems).
+ *	SpectrumStream ties the two together with a list of peak windows.
+ *	               Only windows that overlap the changed channels are
+ *	               refitted, and the refits of a burst of writes are
+ *	               coalesced: a window is published at most latency_ms
+ *	               (plus the fit time) after its first unpublished change.
+ *
+ *	Windows are given in histogram bins, the same numbers used by
+ *	attenuation.C and angular_study.C (bin = channel + 1 for the dense
+ *	MCA files, which start at channel 0).
+ *
+ *	Nothing here depends on ROOT.
+ **/
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "xytools.h"
+#include "subtags.h"
+#include "peakfit.h"
+#include "workpool.h"
+
+// Bytes read back at the start and at the end of what XYTail consumed to
+// tell an in-place rewrite from an append
+#define XY_PROBE_BYTES ((size_t)4096)
+
+// "tagNNNN.xy" -> NNNN (tag*10 + subtag, as gss_key), -1 otherwise
+static inline int xy_tag_key(const char* fname)
+{
+	if( std::strncmp(fname, "tag", 3) != 0 ) return -1;
+	const char* p = fname + 3;
+	int key = 0, ndigits = 0;
+	for( ; *p >= '0' && *p <= '9'; p++, ndigits++ ) key = key*10 + (*p - '0');
+	if( ndigits < 2 || std::strcmp(p, ".xy") != 0 ) return -1;
+	return key;
+}
+
+
+/*
+ * Class: XYTail
+ * Brief:
+ *	Incremental reader of one .xy file. counts()[chan] is the content
+ *	of channel chan (channels are not rebased).
+ */
+class XYTail
+{
+public:
+	XYTail(const std::string& path) : _path(path), _offset(0), _ino(0), _mtime(0), _nlines(0) { }
+
+	// Reads what changed since the last call. [lo, hi] is the changed
+	// channel range (lo > hi if nothing changed). Returns false if the
+	// file cannot be read.
+	bool update(int& lo, int& hi);
+
+	const std::vector<int>& counts() const { return _counts; }
+	size_t bytes() const { return _offset; }
+	size_t lines() const { return _nlines; }
+
+private:
+	static size_t _pread_all(int fd, size_t off, size_t len, std::vector<char>& buf);
+	bool _probes_match(int fd) const;
+	void _remember(const char* p, size_t len);
+	void _consume(const char* p, size_t len, int& lo, int& hi);
+
+private:
+	std::string _path;
+	size_t  _offset;          // bytes already read
+	ino_t   _ino;
+	int64_t _mtime;           // ns
+	size_t  _nlines;
+	std::string _head;        // first XY_PROBE_BYTES consumed bytes
+	std::string _tail;        // last XY_PROBE_BYTES bytes before _offset
+	std::string _partial;     // unterminated last line
+	std::vector<int> _counts;
+};
+
+
+/*
+ * Class: XYWatcher
+ * Brief:
+ *	Reports tagNNNN.xy files of one directory (not recursive) that were
+ *	created, written or moved in.
+ */
+class XYWatcher
+{
+public:
+	XYWatcher(const std::string& dir, bool use_inotify = true, int poll_ms = 100);
+	~XYWatcher();
+	XYWatcher(const XYWatcher&) = delete;
+	XYWatcher& operator=(const XYWatcher&) = delete;
+
+public:
+	// Waits at most timeout_ms for changes and puts the names (not
+	// paths) of the files that may have changed in changed. The first
+	// call reports every file already in the directory.
+	void wait(int timeout_ms, std::vector<std::string>& changed);
+	bool usingInotify() const { return _fd >= 0; }
+	const std::string& dir() const { return _dir; }
+
+private:
+	void _scan(std::vector<std::string>& changed);
+
+private:
+	struct _stamp_t { ino_t ino; off_t size; int64_t mtime; };
+	std::string _dir;
+	int  _fd;
+	int  _poll_ms;
+	bool _first;
+	std::map<std::string, _stamp_t> _seen;
+};
+
+
+struct stream_window_t
+{
+	std::string name;      // e.g. g11_040_126_168
+	int key;               // tag*10 + subtag of the spectrum
+	int xlow, xhigh;       // bins, inclusive
+
+	// Latest published results
+	double sum, sum_err;   // window integral, Poisson error
+	peak_result_t fit;     // gaus+pol1, see peakfit.h
+	unsigned long version; // number of publishes
+	double latency;        // s from the first unpublished change to the publish
+	bool dirty;
+};
+
+/*
+ * Class: SpectrumStream
+ * Brief:
+ *	Watches dir, keeps every tagNNNN.xy spectrum in memory and
+ *	republishes the windows whose channels changed.
+ */
+class SpectrumStream
+{
+public:
+	typedef std::function<void(const stream_window_t&)> publish_fn;
+
+	SpectrumStream(const std::string& dir, int latency_ms = 500, bool use_inotify = true, unsigned nthreads = 0);
+
+public:
+	// Window [xlow, xhigh] on subtag sub of tag group tag, tag < 0 means
+	// every tag group that shows up in the directory
+	void addWindow(int sub, int xlow, int xhigh, int tag = -1);
+
+	// One turn: waits for changes (at most idle_ms if nothing is pending),
+	// ingests them and publishes the windows that are due. Returns the
+	// number of windows published.
+	int step(const publish_fn& publish, int idle_ms = 1000);
+	// Calls step(...) for seconds (<= 0 forever)
+	void run(double seconds, const publish_fn& publish);
+
+	const std::vector<int>* spectrum(int key) const;
+	const std::vector<stream_window_t>& windows() const { return _windows; }
+	size_t bytes() const;
+	bool usingInotify() const { return _watcher.usingInotify(); }
+
+private:
+	struct _window_def_t { int sub, tag, xlow, xhigh; };
+	typedef std::chrono::steady_clock _clock;
+
+	void _instantiate(int key, const _window_def_t& d);
+	void _ingest(const std::string& fname);
+	int  _publish(const publish_fn& publish);
+
+private:
+	XYWatcher _watcher;
+	WorkPool  _pool;
+	int       _latency_ms;
+	std::map<int, std::unique_ptr<XYTail>> _tails;
+	std::map<int, std::vector<size_t>>     _by_key;   // windows of each spectrum
+	std::vector<_window_def_t>   _defs;
+	std::vector<stream_window_t> _windows;
+	bool _pending;
+	_clock::time_point _first_change;
+};
+
+///////////////////////////////////////////////////////////////////////////////////
+////////////////////// IMPLEMENTATION /////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+
+// Reads up to len bytes at off into buf (resized to what was read)
+size_t XYTail::_pread_all(int fd, size_t off, size_t len, std::vector<char>& buf)
+{
+	buf.resize(len);
+	size_t got = 0;
+	while( got < len ) {
+		ssize_t n = pread(fd, buf.data() + got, len - got, (off_t)(off + got));
+		if( n <= 0 ) break;
+		got += (size_t)n;
+	}
+	buf.resize(got);
+	return got;
+}
+
+// Compares the bytes of fd at the two probes with what was consumed there
+bool XYTail::_probes_match(int fd) const
+{
+	std::vector<char> buf;
+	if( _pread_all(fd, 0, _head.size(), buf) != _head.size() || std::memcmp(buf.data(), _head.data(), _head.size()) != 0 )
+		return false;
+	if( _pread_all(fd, _offset - _tail.size(), _tail.size(), buf) != _tail.size() || std::memcmp(buf.data(), _tail.data(), _tail.size()) != 0 )
+		return false;
+	return true;
+}
+
+// Keeps the probes up to date with the bytes p[0 .. len) just consumed
+void XYTail::_remember(const char* p, size_t len)
+{
+	if( _head.size() < XY_PROBE_BYTES ) _head.append(p, std::min(len, XY_PROBE_BYTES - _head.size()));
+	if( len >= XY_PROBE_BYTES ) {
+		_tail.assign(p + len - XY_PROBE_BYTES, XY_PROBE_BYTES);
+		return;
+	}
+	_tail.append(p, len);
+	if( _tail.size() > XY_PROBE_BYTES ) _tail.erase(0, _tail.size() - XY_PROBE_BYTES);
+}
+
+/*
+ * Func: update
+ * Comments:
+ *	Appending moves the mtime too, so a new mtime alone says nothing.
+ *	An MCA that truncates the file and dumps it again in place keeps
+ *	the inode and can end up larger than before, which would look like
+ *	an append. So whenever the mtime moved, the first XY_PROBE_BYTES
+ *	and the last XY_PROBE_BYTES consumed bytes are read back and
+ *	compared before resuming at _offset. A full dump shifts both, and
+ *	the cost per write stays two small reads plus the new bytes.
+ */
+bool XYTail::update(int& lo, int& hi)
+{
+	lo = INT_MAX; hi = INT_MIN;
+	int fd = open(_path.c_str(), O_RDONLY);
+	if( fd < 0 ) return false;
+	struct stat st;
+	if( fstat(fd, &st) != 0 ) { close(fd); return false; }
+	size_t  size  = (size_t)st.st_size;
+	int64_t mtime = (int64_t)st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+
+	// Replaced (rename over it), truncated, or rewritten in place
+	bool rewritten = ( _ino != 0 && st.st_ino != _ino ) || size < _offset;
+	if( !rewritten && _offset > 0 && mtime != _mtime && !_probes_match(fd) ) rewritten = true;
+
+	std::vector<int> old;
+	if( rewritten ) {
+		old.swap(_counts);
+		_offset = 0; _nlines = 0;
+		_head.clear(); _tail.clear();
+		_partial.clear();
+	}
+
+	bool ok = true;
+	std::vector<char> buf;
+	if( size > _offset ) {
+		ok = _pread_all(fd, _offset, size - _offset, buf) > 0;
+		if( !buf.empty() ) {
+			_consume(buf.data(), buf.size(), lo, hi);
+			_remember(buf.data(), buf.size());
+			_offset += buf.size();
+		}
+	}
+	close(fd);
+	_ino   = st.st_ino;
+	_mtime = mtime;
+
+	if( rewritten ) {
+		// Changed range is wherever the old and new contents differ
+		lo = INT_MAX; hi = INT_MIN;
+		size_t n = std::max(old.size(), _counts.size());
+		for( size_t i = 0; i < n; i++ ) {
+			int a = i < old.size() ? old[i] : 0;
+			int b = i < _counts.size() ? _counts[i] : 0;
+			if( a != b ) { if( (int)i < lo ) lo = (int)i; hi = (int)i; }
+		}
+	}
+	return ok;
+}
+
+/*
+ * Func: _consume
+ * Brief:
+ *	Adds the complete lines of _partial + p[0 .. len) to the counts and
+ *	keeps the unterminated rest for the next call. Malformed lines and
+ *	channels outside [0, XY_MAX_CHANNEL] are reported and skipped.
+ */
+void XYTail::_consume(const char* p, size_t len, int& lo, int& hi)
+{
+	const char* nl = (const char*)memrchr(p, '\n', len);
+	if( nl == NULL ) { _partial.append(p, len); return; }
+
+	std::string chunk;
+	const char* beg = p;
+	const char* end = nl + 1;
+	if( !_partial.empty() ) {
+		chunk.swap(_partial);
+		chunk.append(p, end - p);
+		beg = chunk.data();
+		end = chunk.data() + chunk.size();
+	}
+	int chan, cnt, s;
+	const char* q = beg;
+	while( (s = _xy_parse_int(q, end, chan)) != xp_end ) {
+		if( s == xp_ok ) s = _xy_parse_int(q, end, cnt);
+		if( s != xp_ok || chan < 0 || chan > XY_MAX_CHANNEL ) {
+			// a live file keeps going: drop the line and resync after it
+			std::fprintf(stderr, "XYTail: skipping malformed line after %zu lines of %s\n", _nlines, _path.c_str());
+			const char* eol = (const char*)memchr(q, '\n', end - q);
+			q = eol ? eol + 1 : end;
+			continue;
+		}
+		_nlines++;
+		if( cnt == 0 ) continue;
+		if( (size_t)chan >= _counts.size() ) _counts.resize( (size_t)chan + 1, 0 );
+		_counts[chan] += cnt;
+		if( chan < lo ) lo = chan;
+		if( chan > hi ) hi = chan;
+	}
+	_partial.assign(nl + 1, p + len - (nl + 1));
+}
+
+
+XYWatcher::XYWatcher(const std::string& dir, bool use_inotify, int poll_ms) : _dir(dir), _fd(-1), _poll_ms(poll_ms), _first(true)
+{
+	if( !use_inotify ) return;
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if( _fd >= 0 && inotify_add_watch(_fd, dir.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0 ) {
+		close(_fd);
+		_fd = -1;
+	}
+	if( _fd < 0 ) std::fprintf(stderr, "XYWatcher: no inotify for %s, polling every %d ms\n", dir.c_str(), poll_ms);
+}
+
+XYWatcher::~XYWatcher()
+{
+	if( _fd >= 0 ) close(_fd);
+}
+
+/*
+ * Func: _scan
+ * Brief:
+ *	Stats every tagNNNN.xy file and reports the ones whose inode, size
+ *	or time stamp moved since the last scan.
+ */
+void XYWatcher::_scan(std::vector<std::string>& changed)
+{
+	DIR* d = opendir(_dir.c_str());
+	if( d == NULL ) return;
+	struct dirent* ent;
+	while( (ent = readdir(d)) != NULL ) {
+		if( xy_tag_key(ent->d_name) < 0 ) continue;
+		struct stat st;
+		std::string path = _dir + "/" + ent->d_name;
+		if( stat(path.c_str(), &st) != 0 ) continue;
+		_stamp_t s = { st.st_ino, st.st_size, (int64_t)st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec };
+		auto it = _seen.find(ent->d_name);
+		if( it != _seen.end() && it->second.ino == s.ino && it->second.size == s.size && it->second.mtime == s.mtime ) continue;
+		_seen[ent->d_name] = s;
+		changed.push_back(ent->d_name);
+	}
+	closedir(d);
+}
+
+void XYWatcher::wait(int timeout_ms, std::vector<std::string>& changed)
+{
+	changed.clear();
+	if( _first ) {
+		_first = false;
+		_scan(changed);
+		if( !changed.empty() ) return;
+	}
+	if( timeout_ms < 0 ) timeout_ms = 0;
+
+	if( _fd < 0 ) {
+		auto t0 = std::chrono::steady_clock::now();
+		while( true ) {
+			_scan(changed);
+			int left = timeout_ms - (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+			if( !changed.empty() || left <= 0 ) return;
+			std::this_thread::sleep_for( std::chrono::milliseconds( std::min(left, _poll_ms) ) );
+		}
+	}
+
+	struct pollfd pfd = { _fd, POLLIN, 0 };
+	if( poll(&pfd, 1, timeout_ms) <= 0 ) return;
+	std::set<std::string> names;
+	alignas(struct inotify_event) char buf[16384];
+	ssize_t n;
+	while( (n = read(_fd, buf, sizeof(buf))) > 0 ) {
+		for( char* p = buf; p < buf + n; ) {
+			struct inotify_event* ev = (struct inotify_event*)p;
+			if( ev->mask & IN_Q_OVERFLOW ) {
+				// Lost events, fall back on comparing stamps
+				std::vector<std::string> all;
+				_scan(all);
+				names.insert(all.begin(), all.end());
+			}
+			else if( ev->len && xy_tag_key(ev->name) >= 0 ) names.insert(ev->name);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	changed.assign(names.begin(), names.end());
+}
+
+
+SpectrumStream::SpectrumStream(const std::string& dir, int latency_ms, bool use_inotify, unsigned nthreads)
+	: _watcher(dir, use_inotify), _pool(nthreads), _latency_ms(latency_ms), _pending(false) { }
+
+void SpectrumStream::addWindow(int sub, int xlow, int xhigh, int tag)
+{
+	_window_def_t d = { sub, tag, xlow, xhigh };
+	_defs.push_back(d);
+	for( auto it = _tails.begin(); it != _tails.end(); it++ ) _instantiate(it->first, d);
+}
+
+void SpectrumStream::_instantiate(int key, const _window_def_t& d)
+{
+	if( key % 10 != d.sub || ( d.tag >= 0 && key / 10 != d.tag ) ) return;
+	stream_window_t w;
+	char name[64];
+	std::snprintf(name, sizeof(name), "%s_%03d_%d_%d", subtag_name(d.sub), key / 10, d.xlow, d.xhigh);
+	w.name  = name;
+	w.key   = key;
+	w.xlow  = d.xlow;
+	w.xhigh = d.xhigh;
+	w.sum   = 0; w.sum_err = 0;
+	std::memset(&w.fit, 0, sizeof(w.fit));
+	w.version = 0;
+	w.latency = 0;
+	w.dirty   = true;
+	_by_key[key].push_back(_windows.size());
+	_windows.push_back(w);
+	if( !_pending ) { _pending = true; _first_change = _clock::now(); }
+}
+
+void SpectrumStream::_ingest(const std::string& fname)
+{
+	int key = xy_tag_key(fname.c_str());
+	auto it = _tails.find(key);
+	bool is_new = it == _tails.end();
+	if( is_new ) it = _tails.emplace(key, std::unique_ptr<XYTail>( new XYTail(_watcher.dir() + "/" + fname) )).first;
+
+	// A file that cannot be read yet is forgotten again, so the windows
+	// are made on its first successful read
+	int lo, hi;
+	if( !it->second->update(lo, hi) ) {
+		if( is_new ) _tails.erase(it);
+		return;
+	}
+	if( is_new ) for( size_t i = 0; i < _defs.size(); i++ ) _instantiate(key, _defs[i]);
+	if( lo > hi ) return;
+
+	// bin = channel + 1
+	std::vector<size_t>& vw = _by_key[key];
+	for( size_t i = 0; i < vw.size(); i++ ) {
+		stream_window_t& w = _windows[ vw[i] ];
+		if( w.xhigh < lo+1 || w.xlow > hi+1 ) continue;
+		w.dirty = true;
+		if( !_pending ) { _pending = true; _first_change = _clock::now(); }
+	}
+}
+
+/*
+ * Func: _publish
+ * Brief:
+ *	Refits every dirty window on the pool, then hands the results to
+ *	publish in window order.
+ */
+int SpectrumStream::_publish(const publish_fn& publish)
+{
+	std::vector<size_t> vdirty;
+	for( size_t i = 0; i < _windows.size(); i++ ) if( _windows[i].dirty ) vdirty.push_back(i);
+
+	for( size_t k = 0; k < vdirty.size(); k++ ) {
+		stream_window_t* w = &_windows[ vdirty[k] ];
+		const std::vector<int>* c = &_tails[w->key]->counts();
+		_pool.submit( [w, c]{
+			peak_job_t job;
+			double sum = 0;
+			for( int bin = w->xlow; bin <= w->xhigh; bin++ ) {
+				int chan = bin - 1;
+				double y = ( chan >= 0 && (size_t)chan < c->size() ) ? (*c)[chan] : 0;
+				job.x.push_back(chan);
+				job.y.push_back(y);
+				job.e.push_back( std::sqrt(y) );
+				sum += y;
+			}
+			w->sum     = sum;
+			w->sum_err = std::sqrt(sum);
+			w->fit     = fit_peak(job);
+		} );
+	}
+	_pool.wait();
+
+	double latency = std::chrono::duration<double>(_clock::now() - _first_change).count();
+	for( size_t k = 0; k < vdirty.size(); k++ ) {
+		stream_window_t& w = _windows[ vdirty[k] ];
+		w.dirty   = false;
+		w.latency = latency;
+		w.version++;
+		if( publish ) publish(w);
+	}
+	_pending = false;
+	return (int)vdirty.size();
+}
+
+int SpectrumStream::step(const publish_fn& publish, int idle_ms)
+{
+	int timeout = idle_ms;
+	if( _pending ) {
+		auto due = _first_change + std::chrono::milliseconds(_latency_ms);
+		timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(due - _clock::now()).count();
+		if( timeout < 0 ) timeout = 0;
+	}
+	std::vector<std::string> changed;
+	_watcher.wait(timeout, changed);
+	for( size_t i = 0; i < changed.size(); i++ ) _ingest(changed[i]);
+
+	if( _pending && _clock::now() >= _first_change + std::chrono::milliseconds(_latency_ms) )
+		return _publish(publish);
+	return 0;
+}
+
+void SpectrumStream::run(double seconds, const publish_fn& publish)
+{
+	auto t0 = _clock::now();
+	while( seconds <= 0 || std::chrono::duration<double>(_clock::now() - t0).count() < seconds ) {
+		int idle = 1000;
+		if( seconds > 0 ) {
+			double left = seconds - std::chrono::duration<double>(_clock::now() - t0).count();
+			idle = std::max(0, std::min(idle, (int)(left*1000)));
+		}
+		step(publish, idle);
+	}
+	// Flush whatever is still waiting
+	if( _pending ) _publish(publish);
+}
+
+const std::vector<int>* SpectrumStream::spectrum(int key) const
+{
+	auto it = _tails.find(key);
+	return it == _tails.end() ? NULL : &it->second->counts();
+}
+
+size_t SpectrumStream::bytes() const
+{
+	size_t n = 0;
+	for( auto it = _tails.begin(); it != _tails.end(); it++ ) n += it->second->bytes();
+	return n;
+}
+
+#endif
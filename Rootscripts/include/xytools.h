@@ -0,0 +1,219 @@
+#ifndef XYTOOLS_H
+#define XYTOOLS_H
+/***
+ * File: xytools.h
+ *
+ * Discription:
+ *	Fast reader for the columnar "chan counts" .xy files written by
+ *	the MCA. The file is memory mapped and the two integer columns are
+ *	scanned by hand (no iostreams, no locale) straight into a
+ *	contiguous counts array indexed by channel.
+ *
+ *	read_xy_mmap(...) is independent of ROOT so it can be used from
+ *	compiled drivers as well as from the macros.
+ **/
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <climits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct xy_spectrum_t
+{
+	std::vector<int> counts; // counts[i] is the content of channel (min + i)
+	int    min    = 0;       // lowest channel seen
+	int    max    = -1;      // highest channel seen
+	size_t nlines = 0;       // number of (chan, counts) pairs parsed
+	size_t nbytes = 0;       // size of the file on disk
+};
+
+// Highest channel accepted; a corrupt line must not size the counts array
+#define XY_MAX_CHANNEL (1 << 20)
+
+// What _xy_parse_int found
+enum xy_parse_status
+{
+	xp_end = 0,   // only white space left
+	xp_ok  = 1,   // val holds the number
+	xp_bad = 2    // not a decimal int; p is left at the offending byte
+};
+
+static inline bool _xy_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Func: _xy_parse_int
+ * Brief:
+ *	Skips any leading white space and parses one (optionally negative)
+ *	decimal integer. Returns an xy_parse_status.
+ * Comments:
+ *	The number must have at least one digit, fit in an int and be
+ *	followed by white space or the end of the buffer, so "12abc", "-"
+ *	or a stray word are xp_bad instead of being skipped. The digit test
+ *	is a single unsigned compare, so the inner loop has one well
+ *	predicted branch per character.
+ */
+static inline int _xy_parse_int(const char*& p, const char* end, int& val)
+{
+	while( p < end && _xy_is_space(*p) ) p++;
+	if( p >= end ) return xp_end;
+
+	bool neg = *p == '-';
+	if( neg ) p++;
+
+	const char* digits = p;
+	unsigned v = 0, d;
+	while( p < end && (d = (unsigned char)(*p - '0')) <= 9 ) {
+		if( v > (INT_MAX - d) / 10 ) return xp_bad;
+		v = v*10 + d;
+		p++;
+	}
+	if( p == digits || ( p < end && !_xy_is_space(*p) ) ) return xp_bad;
+	val = neg ? -(int)v : (int)v;
+	return xp_ok;
+}
+
+/*
+ * Func: parse_xy_buffer
+ * Brief:
+ *	Parses a buffer of "chan counts" pairs into spec. Channels do not
+ *	need to be sorted, but must lie in [0, XY_MAX_CHANNEL]. Repeated
+ *	channels are summed. Returns false (and prints why) on anything
+ *	but white space separated integers.
+ */
+static inline bool parse_xy_buffer(const char* buf, size_t len, xy_spectrum_t& spec)
+{
+	const char* p   = buf;
+	const char* end = buf + len;
+
+	spec.counts.clear();
+	spec.min = INT_MAX; spec.max = INT_MIN; spec.nlines = 0;
+
+	// The MCA files are dense, one line per channel starting at 0,
+	// so this is usually a single allocation
+	std::vector<int>& c = spec.counts;
+	c.reserve( len / 4 + 1 );
+
+	int chan, cnt, s;
+	while( (s = _xy_parse_int(p, end, chan)) != xp_end ) {
+		if( s == xp_ok ) s = _xy_parse_int(p, end, cnt);
+		if( s == xp_bad ) {
+			std::fprintf(stderr, "parse_xy_buffer(): malformed number at byte %zu\n", (size_t)(p - buf));
+			return false;
+		}
+		if( s == xp_end ) {
+			std::fprintf(stderr, "parse_xy_buffer(): dangling channel %d without counts\n", chan);
+			return false;
+		}
+		if( chan < 0 ) {
+			std::fprintf(stderr, "parse_xy_buffer(): negative channel %d\n", chan);
+			return false;
+		}
+		if( chan > XY_MAX_CHANNEL ) {
+			std::fprintf(stderr, "parse_xy_buffer(): channel %d above %d\n", chan, XY_MAX_CHANNEL);
+			return false;
+		}
+		if( (size_t)chan >= c.size() ) c.resize( (size_t)chan + 1, 0 );
+		c[chan] += cnt;
+		if( chan > spec.max ) spec.max = chan;
+		if( chan < spec.min ) spec.min = chan;
+		spec.nlines++;
+	}
+	if( spec.nlines == 0 ) {
+		spec.min = 0; spec.max = -1;
+		return true;
+	}
+	// Rebase so counts[0] corresponds to the lowest channel
+	if( spec.min > 0 ) c.erase( c.begin(), c.begin() + spec.min );
+	return true;
+}
+
+/*
+ * Func: read_xy_mmap
+ * Brief:
+ *	Memory maps fname and parses it with parse_xy_buffer(...)
+ * Comments:
+ *	Returns false (and prints why) if the file cannot be opened or
+ *	is malformed. Empty files give an empty spectrum.
+ */
+static inline bool read_xy_mmap(const char* fname, xy_spectrum_t& spec)
+{
+	int fd = open(fname, O_RDONLY);
+	if( fd < 0 ) {
+		std::fprintf(stderr, "read_xy_mmap(): cannot open %s\n", fname);
+		return false;
+	}
+	struct stat st;
+	if( fstat(fd, &st) != 0 ) {
+		std::fprintf(stderr, "read_xy_mmap(): cannot stat %s\n", fname);
+		close(fd);
+		return false;
+	}
+	spec.nbytes = (size_t)st.st_size;
+	if( spec.nbytes == 0 ) {
+		close(fd);
+		spec.counts.clear(); spec.min = 0; spec.max = -1; spec.nlines = 0;
+		return true;
+	}
+
+	void* map = mmap(NULL, spec.nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if( map == MAP_FAILED ) {
+		std::fprintf(stderr, "read_xy_mmap(): cannot mmap %s\n", fname);
+		return false;
+	}
+	madvise(map, spec.nbytes, MADV_SEQUENTIAL);
+
+	bool ok = parse_xy_buffer( (const char*)map, spec.nbytes, spec );
+	munmap(map, spec.nbytes);
+	if( !ok ) std::fprintf(stderr, "read_xy_mmap(): malformed file %s\n", fname);
+	return ok;
+}
+
+/*
+ * Func: xy_file_hash
+ * Brief:
+ *	Folds the raw bytes of fname into a 64 bit FNV-1a hash, used to
+ *	tell if a file really changed when only its time stamp did.
+ * Comments:
+ *	Start hash at XY_HASH_SEED; several files can be chained into one
+ *	hash by passing the same variable. Returns false if the file
+ *	cannot be read.
+ */
+#define XY_HASH_SEED 1469598103934665603ULL
+
+// Folds p[0 .. len) into hash (FNV-1a), as xy_file_hash
+static inline void xy_buffer_hash(const void* p, size_t len, uint64_t& hash)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	for( size_t i = 0; i < len; i++ ) {
+		hash ^= b[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+static inline bool xy_file_hash(const char* fname, uint64_t& hash)
+{
+	int fd = open(fname, O_RDONLY);
+	if( fd < 0 ) return false;
+	struct stat st;
+	if( fstat(fd, &st) != 0 ) { close(fd); return false; }
+	size_t len = (size_t)st.st_size;
+	if( len == 0 ) { close(fd); return true; }
+
+	void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if( map == MAP_FAILED ) return false;
+	xy_buffer_hash(map, len, hash);
+	munmap(map, len);
+	return true;
+}
+
+#endif